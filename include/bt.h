@@ -12,7 +12,8 @@
 typedef enum 
 {
 	INDEX_NODE,
-	LEAF_NODE		
+	LEAF_NODE,
+	POSTING_NODE
 } NodeType;
 
 struct LeafEntry {
@@ -0,0 +1,25 @@
+#ifndef _BTBUFFER_H
+#define _BTBUFFER_H
+
+#include "heappage.h"
+#include "latch.h"
+
+// The B+ tree calls the buffer manager through the buffer latch, so
+// that a thread-safe tree may be shared by several threads.  The page
+// macros of heappage.h are redefined here to do so.
+
+#undef PIN
+#undef UNPIN
+#undef FREEPAGE
+#undef NEWPAGE
+
+#define PIN(a, b)   if (BufferLatch::PinPage((a), (Page *&)(b)) != OK) {\
+						cerr << "Unable to pin page " << a << endl; return FAIL; }
+#define UNPIN(a, b) if (BufferLatch::UnpinPage((a), (b)) != OK) {\
+						cerr << "Unable to unpin page " << a << endl; return FAIL; }
+#define FREEPAGE(a) if (BufferLatch::FreePage((a)) != OK) {\
+						cerr << "Unable to free page " << a << endl; return FAIL; }
+#define NEWPAGE(a, b)  if (BufferLatch::NewPage((a), (Page *&)(b)) != OK) {\
+						cerr << "Unable to allocate new page " << a << endl; return FAIL; }
+
+#endif
@@ -3,11 +3,20 @@
 
 #include "btindex.h"
 #include "btleaf.h"
+#include "btposting.h"
 #include "index.h"
 #include "btfilescan.h"
 #include "bt.h"
-#include <stack>
+#include "btbuffer.h"
+#include "snapshot.h"
 #include <string>
+#include <vector>
+#include <algorithm>
+
+class BTreeFileScan;
+
+// Called by BTreeFile::MultiLookup for every matching entry.
+typedef void (*LookupCallback)(const int key, const RecordID rid, void* context);
 
 class BTreeFile: public IndexFile {
 
@@ -15,50 +24,265 @@ public:
 
 	friend class BTreeFileScan;
 
-	BTreeFile(Status& status, const char* filename);
+	// A thread-safe tree may be used by several threads at once.  See
+	// Descend for how they share it.
+	BTreeFile(Status& status, const char* filename, bool threadSafe = false);
 	~BTreeFile();
 
 	Status DestroyFile();
 
 	Status Insert(const int key, const RecordID rid);
 	Status Delete(const int key, const RecordID rid);
+	Status InsertIfAbsent(const int key, const RecordID rid);
+	Status Upsert(const int key, const RecordID rid);
+
+	// Start from the leaf an open scan of this index is on.
+	Status Insert(const int key, const RecordID rid, IndexFileScan* hint);
+	Status Delete(const int key, const RecordID rid, IndexFileScan* hint);
 
-	IndexFileScan* OpenScan(const int* lowKey, const int* highKey);
+	Status BulkLoad(const LeafEntry* entries, int numEntries, float fillFactor = 1.0);
+	Status InsertBatch(const LeafEntry* entries, size_t numEntries);
+	Status DeleteRange(const int* lowKey, const int* highKey);
+
+	// A snapshot scan sees the index as it is when the scan is opened,
+	// and does not hold writers up.
+	IndexFileScan* OpenScan(const int* lowKey, const int* highKey, bool snapshot = false);
+	Status Lookup(const int key, RecordID* rids, int maxRids, int& numFound);
+	Status MultiLookup(const int* keys, int numKeys, LookupCallback callback, void* context, long& numPins);
 
 	Status Print();
 	Status DumpStatistics();
 
-private:
+	// A node left below redistributeBelow of its capacity by a delete
+	// takes entries from a sibling that can spare them, and one below
+	// mergeBelow is merged with a sibling if the two fit in one page.
+	// Both are fractions of a node and last while the file is open.
+	Status SetRebalanceThresholds(float mergeBelow, float redistributeBelow);
 
-	// You may add members and methods here.
+	// Splits, merges and redistributions since the file was opened.
+	struct RebalanceCounters {
+		long leafSplits, indexSplits;
+		long leafMerges, indexMerges;
+		long leafRedistributions, indexRedistributions;
+	};
+
+	const RebalanceCounters& GetRebalanceCounters() const { return counters; }
+
+private:
 
 	PageID rootPid;
-    stack<PageID> path;
     char *dbname;
 
+    #define MAX_TREE_DEPTH 32
+    #define MAX_LATCHED_PAGES (2 * MAX_TREE_DEPTH + 4)
+
+    // A split of two leaves into three tries split points up to this
+    // many entries either side of the thirds.
+    #define SPLIT_WINDOW_DIVISOR 6
+
+    // The index pages from the root down to the parent of a leaf.  It
+    // lives on the stack of the operation that walked it, so that no
+    // descent state is shared through the tree object.
+    struct TreePath {
+        PageID pids[MAX_TREE_DEPTH];
+        int depth;
+        bool hasLow, hasHigh;
+        int lowKey, highKey;
+
+        // In thread-safe mode, the latches the operation holds: that of
+        // the root pointer, and those of the pages in latched, in the
+        // order they were taken.  What is left is given up when the
+        // path goes out of scope.  The versions of what the operation
+        // is changing for optimistic readers are locked until then.
+        Latch *rootLatch;
+        Version *rootVersion;
+        LatchMode mode;
+        bool rootLatched, rootWritten;
+        PageID latched[MAX_LATCHED_PAGES];
+        bool written[MAX_LATCHED_PAGES];
+        int numLatched;
+
+        TreePath() : rootLatch(nullptr), rootLatched(false), rootWritten(false), numLatched(0) {}
+        TreePath(const TreePath&) = delete;
+        ~TreePath() { UnlatchAll(); }
+
+        PageID Parent() const
+        {
+            return (depth > 0) ? pids[depth - 1] : INVALID_PAGE;
+        }
+
+        bool Latching() const { return rootLatch != nullptr; }
+        void StartLatching(Latch *root, Version *version, LatchMode latchMode);
+        void LatchRoot();
+        void LatchPage(PageID pid);
+        bool TryLatchPage(PageID pid);
+        bool Holds(PageID pid) const;
+        void WriteRoot();
+        void WritePage(PageID pid);
+        void UnlatchPage(PageID pid);
+        void UnlatchAbove();
+        void UnlatchAfter(PageID pid);
+        void UnlatchAll();
+
+    private:
+
+        void ReleaseRoot();
+        void Release(int i);
+    };
+
+    // Operation tags for Descend.  Operations that may split or merge
+    // pages keep the path, so that they can walk back up without
+    // searching again.
+    // Change is what the operation may do to the number of entries of
+    // a page, which tells the pages it will not split or merge.
+    struct SearchOp { enum { KeepPath = false, Change = 0 }; };
+    struct InsertOp { enum { KeepPath = true, Change = +1 }; };
+    struct DeleteOp { enum { KeepPath = true, Change = -1 }; };
+
+    // The key range a node covers, bounded by the separators above it.
+    struct KeyRange {
+        bool hasLow, hasHigh;
+        int low, high;
+
+        bool Covers(const int key) const
+        {
+            return (!hasLow || key >= low) && (!hasHigh || key < high);
+        }
+    };
+
+    // A node held pinned across probes.
+    struct PinnedNode : KeyRange {
+        PageID pid;
+        SortedPage *page;
+    };
+
+    // The leaf the last insert went into, not pinned.  Inserts whose key
+    // it covers skip the descent.  Anything that may move leaf bounds
+    // or free a leaf other than a split forgets it.
+    struct CachedLeaf : KeyRange {
+        PageID pid;
+    };
+
+    CachedLeaf lastLeaf;
+
+    // Default rebalance thresholds.  A split leaves two nodes about
+    // half full, so a node has to lose half its entries again before
+    // it is merged back, and its merged page has room to grow.
+    #define DEFAULT_MERGE_FILL 0.25f
+    #define DEFAULT_REDISTRIBUTE_FILL 0.5f
+
+    float mergeFill, redistributeFill;
+    RebalanceCounters counters;
+
+    // Counters may be bumped by several threads at once.
+    #define COUNT(counter) __atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED)
+
+    // Point operations hold treeLatch shared, and operations on the
+    // whole tree or that keep a place in it across calls hold it
+    // exclusively.  rootLatch guards rootPid against writers, and
+    // rootVersion against optimistic readers.
+    bool threadSafe;
+    Latch treeLatch, rootLatch;
+    Version rootVersion;
+
+    Latch* TreeLatch() { return threadSafe ? &treeLatch : nullptr; }
+
+    // The open snapshots of the tree.  Every operation that may change
+    // the tree holds a Snapshots::Writer for them.
+    Snapshots snapshots;
+
+    // Whether a node with numEntries out of capacity is below fill.  A
+    // node without entries always is.
+    static bool Below(int numEntries, int capacity, float fill)
+    {
+        return (numEntries == 0) || (numEntries < fill * capacity);
+    }
+
+    // Totals over the nodes of one kind, gathered by DumpStatistics.
+    // A node's fill factor is its number of entries over its capacity.
+    struct NodeStatistics {
+        int nodes;
+        int entries;
+        double sumFill, minFill, maxFill;
+
+        void Add(int numEntries, int capacity)
+        {
+            double fill = (double)numEntries / capacity;
+            nodes++;
+            entries += numEntries;
+            sumFill += fill;
+            minFill = min(minFill, fill);
+            maxFill = max(maxFill, fill);
+        }
+    };
+
 	Status PrintTree(PageID pid);
 	Status PrintNode(PageID pid);
+	Status CollectStatistics(PageID pid, int level, NodeStatistics& leaves,
+	                         NodeStatistics& indexes, NodeStatistics& postings, int& height);
 
     #define LEAF_NODE 1
     #define INDEX_NODE 0
-    //sizeof(int) + sizeof(RecordID)
-    #define INSERTSIZE 16
-    //sizeof(int) + sizeof(PageID)
-    #define INDEXENTRYSIZE 12
 
-    void clearPath();
+    void RememberLeaf(PageID leafPid, bool hasLow, int low, bool hasHigh, int high);
+    void ForgetLastLeaf() { if (!threadSafe) lastLeaf.pid = INVALID_PAGE; }
+    // What InsertEntry does when key is already in the tree.
+    enum ExistingKey { KEEP_BOTH, KEEP_OLD, REPLACE_OLD };
+
+    Status InsertEntry(const int key, const RecordID rid, ExistingKey existing, bool latch);
+    Status DeleteEntry(const int key, const RecordID rid, bool latch);
+    Status InsertIntoLeaf(PageID leafPid, BTLeafPage *leafPage, const int key,
+                          const RecordID rid, ExistingKey existing, bool& placed);
+    Status AddToLeaf(BTLeafPage *leafPage, const int key, const RecordID rid,
+                     ExistingKey existing, int& slotNo, bool& newEntry, bool& placed);
+    Status RemoveFromLeaf(BTLeafPage *leafPage, const int key, const RecordID rid,
+                          bool keepFilled, int& slotNo, PostingChange& change);
+    Status AddToPostingList(BTLeafPage *leafPage, int slotNo, const RecordID rid, bool& placed);
+    Status RemoveFromPostingList(BTLeafPage *leafPage, int slotNo, const RecordID rid, bool keepFilled,
+                                 PostingChange& change);
+    Status CollapsePostingList(BTLeafPage *leafPage, int slotNo, PostingChange& change);
+    Status BuildPostingList(const LeafEntry* entries, int numEntries, RecordID& dataRid);
+    Status FreePostingList(const RecordID dataRid);
+    Status FindInPostingList(const RecordID dataRid, const RecordID rid, PageID& pid, int& slotNo);
+    template <class Visit>
+    Status VisitRids(const RecordID dataRid, Visit visit);
+    Status NewNode(PageID& pageID, SortedPage*& page, short type, bool reuseRoot);
+    template <class Op>
+    Status Descend(const int key, TreePath& path, PageID& leafPid, BTLeafPage*& leafPage);
+    Status DescendOptimistic(const int key, TreePath& path, PageID& leafPid, BTLeafPage*& leafPage);
+    bool IndexSafe(BTIndexPage *page, bool isRoot, int change);
+    Status SlideToNextLeaf(PinnedNode& leaf, const int key, bool& moved);
+    Status MultiLookupKeys(const int* keys, int numKeys, LookupCallback callback, void* context,
+                           vector<PinnedNode>& pinned, PinnedNode& leaf);
+    Status LatchedMultiLookup(const int* keys, int numKeys, LookupCallback callback, void* context, long& numPins);
+    bool LeafHolds(BTLeafPage *leafPage, const int key);
+    Status PositionScan(BTreeFileScan* scan, const int* key, const RecordID* rid, bool& exact);
+    Status RepositionScan(BTreeFileScan* scan);
     Status DestroyAll(PageID pageID);
-    Status SplitLeafNode(PageID leafPageID, PageID& newRootPageID, const int key, const RecordID rid);
-    Status IndexSearch(PageID indexPid, const int key, const RecordID rid, PageID& outPid, string flag);
-    Status SplitIndex(PageID prevIndexPageID, const int key, const PageID pid);
-    Status LeafInsert(PageID childPid, PageID indexPid, const int key, const RecordID rid);
-    Status ReDistributeMerge(PageID childPid);
-    PageID getSibilingIndex(PageID childPid, PageID parentPid, bool &right);
-    Status IndexReDistributeMerge(PageID indexPid, BTIndexPage *childIndexPage, PageID siblingIndexID, bool right);
-    Status MergeIndex(BTIndexPage *childIndexPage, BTIndexPage *siblingPage, BTIndexPage *indexPage, string flag);
-    Status MergeLeaf(BTLeafPage *childLeafPage, BTLeafPage *siblingPage, BTIndexPage *indexPage, string flag);
-    Status LeafDelete(PageID childPid, PageID indexPid, const int key, const RecordID rid, RecordID& outRid);
-    PageID GetLeftLeaf(PageID parentPid);
+    Status SplitLeafNode(PageID leafPageID, TreePath& path, const int key);
+    Status SplitLeafPage(PageID leafPageID, TreePath& path, const int key, bool pending,
+                         PageID& newLeafPageID, int& firstKey, bool& append);
+    Status SplitLinked(PageID leafPid, TreePath& path, const int key);
+    Status FinishSplit(PageID leftPid, int separator);
+    Status EndSplit(PageID leftPid, SortedPage *leftPage, TreePath& path);
+    Status MakeRoom(PageID leafPid, TreePath& path, const int key, const RecordID rid);
+    Status ShiftToSibling(PageID leftPid, PageID rightPid, const int key,
+                          const RecordID rid, int& separator, bool& shifted);
+    Status SplitLeafPair(TreePath& path, vector<int>& keys, vector<PageID>& pids,
+                         size_t leftPos, const int key);
+    int EvenSplit(const int *keys, const RecordID *rids, int total);
+    Status SplitIndex(TreePath& path, const int key, const PageID pid, bool append);
+    Status SplitIndexPage(PageID prevIndexPageID, TreePath& path, const int key, const PageID pid,
+                          bool append, bool pending, PageID& newIndexPageID, int& firstKey);
+    Status ReDistributeMerge(PageID childPid, TreePath& path);
+    Status IndexReDistributeMerge(TreePath& path);
+    Status DeleteRangeNode(PageID pageID, const int* lowKey, const int* highKey,
+                           const int* lowBound, const int* highBound, int& remaining);
+    Status RelinkLeavesAround(const int* lowKey, const int* highKey);
+    Status FixIndexUnderflow(PageID parentPid, PageID childPid);
+    Status FixIndexChildren(PageID parentPid);
+    Status ReadIndexNode(BTIndexPage *page, vector<int>& keys, vector<PageID>& pids);
+    Status WriteIndexNode(BTIndexPage *page, const vector<int>& keys, const vector<PageID>& pids);
     PageID GetLastLeaf(PageID parentPid);
 };
 
@@ -2,6 +2,8 @@
 #define _BTREE_FILESCAN_H
 
 #include "btfile.h"
+#include "btposting.h"
+#include "snapshot.h"
 
 class BTreeFile;
 
@@ -22,16 +24,45 @@ private:
 	const int *highKey;
 	RecordID scanRid;
 	PageID scanPid;
+	PageID postPid;     // the posting page the scan is on, if any
+	int postSlot;
     int currentKey;
     RecordID currentRid;
     BTreeFile* btf;
 
+    // A snapshot scan reads the tree as it was when the scan was
+    // opened, from copies of its pages.  It keeps the copies of the
+    // leaf and posting page it is on.
+    struct PageCopy {
+        PageID pid;
+        Page page;
+    };
+
+    Snapshot *snapshot;
+    PageCopy leafCopy, postCopy;
+
+    // In thread-safe mode, a live scan holds no latch between calls
+    // to GetNext.  It keeps the versions of the leaf and posting page
+    // it is on, and finds its place again if either has moved on.
+    unsigned long leafVersion, postVersion;
+
 	void setLowKey(const int *lowkey) {lowKey=lowkey;}
 	void setHighKey(const int *highkey) {highKey=highkey;}
 	void setPid(PageID pid) {scanPid=pid;}
 	void setRid(RecordID rid) {scanRid=rid;}
     void setFlag(string input) {flag=input;}
     void setBtf(BTreeFile* inputBtf) {btf=inputBtf;}
+
+    Status ReadPage(PageID pid, Page*& page, PageCopy& copy);
+    Status DoneWithPage(PageID pid);
+    void RememberPages();
+    bool PagesChanged() const;
+
+    // Keep the scan's place when an entry of its leaf comes or goes,
+    // or a record id leaves a posting list on it.
+    void EntryInserted(int slotNo, int key);
+    void EntryDeleted(int slotNo);
+    void RidDeleted(int slotNo, const PostingChange& change);
 };
 
 #endif
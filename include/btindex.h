@@ -7,6 +7,11 @@
 #include "sortedpage.h"
 #include "bt.h"
 
+// Bytes one entry takes in a slotted index page, including its slot.
+const int INDEX_SLOTTED_SIZE = sizeof(IndexEntry) + 2 * sizeof(short);
+
+// Entries a dense index page holds: a key and a child page id each.
+const int INDEX_DENSE_CAPACITY = DENSE_AREA_SIZE / (sizeof(int) + sizeof(PageID));
 
 
 class BTIndexPage : public SortedPage {
@@ -32,17 +37,32 @@ public:
 	PageID GetLeftLink(void);
 	void SetLeftLink(PageID left);
 
-    PageID GetParentLink(void);
-	void SetParentLink(PageID left);
+	PageID GetRightLink(void);
+	void SetRightLink(PageID right);
+
+	IndexEntry GetEntry(int slotNo);
+	void ConvertToDense();
+	int  MoveUpperTo(BTIndexPage& dst, int keep);
+
+	// The child page ids of a dense index page, parallel to its keys.
+	PageID* DensePids()
+	{
+		return (PageID *)(DenseKeys() + INDEX_DENSE_CAPACITY);
+	}
+
+	int Capacity()
+	{
+		return (GetFormat() == DENSE_FORMAT) ? INDEX_DENSE_CAPACITY : HEAPPAGE_DATA_SIZE / INDEX_SLOTTED_SIZE;
+	}
 
-	IndexEntry* GetEntry(int slotNo)
+	bool IsFull()
 	{
-		return (IndexEntry *)(data + slots[slotNo].offset);
+		return (GetNumOfRecords() >= Capacity());
 	}
 
 	bool IsAtLeastHalfFull()
 	{
-		return (AvailableSpace() <= (HEAPPAGE_DATA_SIZE) / 2);
+		return (2 * GetNumOfRecords() >= Capacity());
 	}
 };
 
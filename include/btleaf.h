@@ -7,6 +7,30 @@
 #include "bt.h"
 #include "btindex.h"
 
+// Bytes one entry takes in a slotted leaf, including its slot.
+const int LEAF_SLOTTED_SIZE = sizeof(LeafEntry) + 2 * sizeof(short);
+
+// Entries a dense leaf holds: a key and a record id each.
+const int LEAF_DENSE_CAPACITY = DENSE_AREA_SIZE / (sizeof(int) + sizeof(RecordID));
+
+// A packed leaf stores the lowest key, page number and slot number of
+// its entries once, followed by a column per field of deltas from them.
+// Each column is as wide, in 1, 2 or 4 bytes, as its largest delta
+// needs, so that a leaf whose keys and records are close together
+// holds several times the entries of a dense one.
+const int LEAF_PACKED_HEADER = 3 * sizeof(int) + 1;
+const int LEAF_PACKED_CAPACITY = (DENSE_AREA_SIZE - LEAF_PACKED_HEADER) / 3;
+
+// The slot number of the record id of a leaf entry whose key has more
+// than one record id.  Its page number is the first page of the posting
+// list that holds them, so that the key is stored once.
+const int POSTING_LIST_SLOT = -2;
+
+inline bool IsPostingList(const RecordID& dataRid)
+{
+	return (dataRid.slotNo == POSTING_LIST_SLOT);
+}
+
 
 class BTLeafPage : public SortedPage {
 
@@ -25,14 +49,74 @@ public:
     Status GetLast (int& key, RecordID& dataRid, RecordID& rid);
     Status GetHalf (int& key, RecordID& dataRid, RecordID& rid);
 
-	LeafEntry* GetEntry(int slotNo)
+	Status SetDataRid(int slotNo, const RecordID dataRid);
+	bool   CanSetDataRid(int slotNo, const RecordID dataRid);
+	bool   HasRoomFor(const int key, const RecordID dataRid);
+
+	LeafEntry GetEntry(int slotNo);
+	int  GetKey(int slotNo);
+	int  LowerBound(const int key);
+	int  UpperBound(const int key);
+	int  GetPackedKey(int slotNo);
+	void ConvertToDense();
+
+	int  FillCapacity();
+	int  ReadEntries(int *keys, RecordID *rids);
+	Status WriteEntries(const int *keys, const RecordID *rids, int count);
+	void DecodeKeys(int *keys);
+	int  MoveUpperTo(BTLeafPage& dst, int keep);
+
+	static int  PackedCapacity(const int *keys, const RecordID *rids, int count);
+	static bool Fits(const int *keys, const RecordID *rids, int count);
+
+	// The record ids of a dense leaf, parallel to its keys.
+	RecordID* DenseRids()
+	{
+		return (RecordID *)(DenseKeys() + LEAF_DENSE_CAPACITY);
+	}
+
+	// The lowest key, page number and slot number of a packed leaf.
+	int* PackedBases()
+	{
+		return DenseKeys();
+	}
+
+	// The bytes of a delta of field 0 (key), 1 (page) or 2 (slot).
+	int PackedWidth(int field)
+	{
+		unsigned char widths = *((unsigned char *)DenseKeys() + 3 * sizeof(int));
+		return 1 << ((widths >> (2 * field)) & 3);
+	}
+
+	// The delta columns of a packed leaf: the keys, then the pages,
+	// then the slots, each numOfSlots deltas long.
+	unsigned char* PackedColumn(int field)
+	{
+		unsigned char *column = (unsigned char *)DenseKeys() + LEAF_PACKED_HEADER;
+		for (int i = 0; i < field; i++)
+			column += numOfSlots * PackedWidth(i);
+		return column;
+	}
+
+	int Capacity()
+	{
+		switch (GetFormat())
+		{
+			case DENSE_FORMAT:  return LEAF_DENSE_CAPACITY;
+			case PACKED_FORMAT: return (DENSE_AREA_SIZE - LEAF_PACKED_HEADER)
+			                           / (PackedWidth(0) + PackedWidth(1) + PackedWidth(2));
+			default:            return HEAPPAGE_DATA_SIZE / LEAF_SLOTTED_SIZE;
+		}
+	}
+
+	bool IsFull()
 	{
-		return (LeafEntry *)(data + slots[slotNo].offset);
+		return (GetNumOfRecords() >= Capacity());
 	}
 
 	bool IsAtLeastHalfFull()
 	{
-		return (AvailableSpace() <= (HEAPPAGE_DATA_SIZE) / 2);
+		return (2 * GetNumOfRecords() >= Capacity());
 	}
 
 };
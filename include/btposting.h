@@ -0,0 +1,63 @@
+#ifndef BTPOSTING_PAGE_H
+#define BTPOSTING_PAGE_H
+
+#include "minirel.h"
+#include "page.h"
+#include "sortedpage.h"
+#include "bt.h"
+
+// Record ids a posting page holds.
+const int POSTING_CAPACITY = DENSE_AREA_SIZE / sizeof(RecordID);
+
+// Where a record id was taken from a posting list, so that open scans
+// can keep their place.
+struct PostingChange {
+	PageID pid;         // the posting page, INVALID_PAGE if the record
+	                    // id was inline in its leaf entry
+	int slotNo;         // its position on that page
+	bool freed;         // the page was left empty and freed
+	PageID nextPid;     // the page that followed it
+	bool collapsed;     // one record id is left, moved inline
+	bool moved;         // record ids moved to another page, or the
+	                    // entry went with its last one, so that open
+	                    // scans have to find their place again
+};
+
+
+// A page of the posting list of a key that has more than one record
+// id.  The record ids are kept sorted in the dense area, and the pages
+// of a list are chained through nextPage in ascending order.  prevPage
+// links each page to the one before it, except on the first page,
+// where it points at the last page so that appends find it directly.
+
+class BTPostingPage : public SortedPage {
+
+public:
+
+	Status Insert(const RecordID rid);
+	Status Delete(const RecordID rid, int& slotNo);
+	int    Find(const RecordID rid);
+	void   MoveUpperHalfTo(BTPostingPage& dst);
+
+	RecordID* Rids()
+	{
+		return (RecordID *)DenseKeys();
+	}
+
+	RecordID GetRid(int slotNo)
+	{
+		return Rids()[slotNo];
+	}
+
+	RecordID GetLastRid()
+	{
+		return Rids()[numOfSlots - 1];
+	}
+
+	bool IsFull()
+	{
+		return (GetNumOfRecords() >= POSTING_CAPACITY);
+	}
+};
+
+#endif
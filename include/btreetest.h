@@ -8,8 +8,24 @@ public:
 	BTreeFile* createIndex(const char* name);
 	void destroyIndex(BTreeFile* btf, const char* name);
 	void insertHighLow(BTreeFile* btf, int low, int high);
+	void upsertHighLow(BTreeFile* btf, int low, int high);
+	void insertIfAbsentHighLow(BTreeFile* btf, int low, int high);
+	bool insertIfAbsentChecked(BTreeFile* btf, int low, int high, int& numInserted, int& numKept);
+	void bulkLoadHighLow(BTreeFile* btf, int low, int high);
+	void insertBatchHighLow(BTreeFile* btf, int low, int high);
+	bool insertBatchChecked(BTreeFile* btf, int low, int high, const vector<LeafEntry>& entries);
+	bool countScanned(BTreeFile* btf, int low, int high, int& count);
 	void scanHighLow(BTreeFile* btf, int low, int high);
+	void lookupHighLow(BTreeFile* btf, int low, int high);
+	void multiLookupHighLow(BTreeFile* btf, int low, int high);
 	void deleteScanHighLow(BTreeFile* btf, int low, int high);
 	void deleteHighLow(BTreeFile* btf, int low, int high);
+	void deleteRangeHighLow(BTreeFile* btf, int low, int high);
+	void searchBenchmark(int numKeys, int iterations);
+	void threadBenchmark(int numKeys, int lookups, int maxThreads);
+	void hintScan(int numKeys);
+	bool hintScanChecked(BTreeFile* btf, int numKeys);
+	void snapshotScan(int numKeys);
+	bool snapshotScanChecked(BTreeFile* btf, int numKeys, long& numKept);
 
 };
@@ -0,0 +1,259 @@
+#ifndef _LATCH_H
+#define _LATCH_H
+
+#include "minirel.h"
+#include "page.h"
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+enum LatchMode { LATCH_SHARED, LATCH_EXCLUSIVE };
+
+// A reader/writer latch.  A waiting writer holds off new readers, so
+// that a stream of readers cannot starve it.  Latches are not
+// re-entrant.
+class Latch {
+
+public:
+
+	Latch() : readers(0), waitingWriters(0), writer(false) {}
+
+	void Acquire(LatchMode mode);
+	bool TryAcquire(LatchMode mode);
+	void Release(LatchMode mode);
+
+private:
+
+	std::mutex mutex;
+	std::condition_variable released;
+	int readers;
+	int waitingWriters;
+	bool writer;
+};
+
+
+// Holds a latch until the end of a scope.  There is nothing to hold if
+// the latch is null.
+class LatchGuard {
+
+public:
+
+	LatchGuard(Latch* latch, LatchMode mode) : latch(latch), mode(mode)
+	{
+		if (latch != nullptr)
+			latch->Acquire(mode);
+	}
+
+	~LatchGuard()
+	{
+		if (latch != nullptr)
+			latch->Release(mode);
+	}
+
+private:
+
+	Latch* latch;
+	LatchMode mode;
+};
+
+
+// The latches on the pages of the database.  A page's latch is taken
+// from its stripe, found by page id, when it is first asked for, and
+// goes back to the stripe when nobody holds or waits for it, so that
+// latches take no room in the pages themselves.  Each page still has
+// a latch of its own: pages sharing one could deadlock a thread that
+// latches both.  Threads only meet on a stripe lock if their pages
+// share the stripe, and a stripe keeps the latches it has made.
+class PageLatches {
+
+	#define PAGE_LATCH_STRIPES 1024
+
+public:
+
+	static void Acquire(PageID pid, LatchMode mode);
+	static bool TryAcquire(PageID pid, LatchMode mode);
+	static void Release(PageID pid, LatchMode mode);
+
+private:
+
+	struct Entry {
+		Latch latch;
+		PageID pid;
+		int users;
+		Entry *next;
+	};
+
+	// The latches in use, and those free to be used again.
+	struct alignas(64) Stripe {
+		std::mutex mutex;
+		Entry *used;
+		Entry *free;
+	};
+
+	static Stripe& Of(PageID pid) { return stripes[(unsigned)pid % PAGE_LATCH_STRIPES]; }
+	static Entry* Use(PageID pid);
+	static Entry* Find(PageID pid);
+	static void Unuse(PageID pid, Entry* entry);
+
+	static Stripe stripes[PAGE_LATCH_STRIPES];
+};
+
+
+// A version word for optimistic reads.  A writer, already excluded
+// from other writers of what the version guards, locks it before a
+// change and unlocks it after, which moves it on.  A reader that sees
+// the same unlocked version before and after reading read no change.
+// Several writers may hold one version that guards several things.
+// A change already excluded from readers by other means moves the
+// version on without locking it.  A version peeked at while a writer
+// is in never validates.
+class Version {
+
+public:
+
+	Version() : value(0) {}
+
+	unsigned long Read() const;
+	unsigned long Peek() const { return value.load(std::memory_order_acquire); }
+	bool Validate(unsigned long seen) const;
+	void Lock();
+	void Unlock();
+	void Move();
+
+private:
+
+	// The low bits count the writers in, the rest is the version.
+	#define VERSION_WRITER_BITS 16
+
+	std::atomic<unsigned long> value;
+};
+
+
+// The versions of the pages of the database, shared out among pages
+// by page id.  Pages that share a version only restart each other's
+// readers.  Reading a version takes no lock.  The buffer latch moves a
+// page's version on whenever the page is unpinned dirty, freed or
+// allocated, so that whoever keeps a page id between operations can
+// tell that the page changed meanwhile.
+class PageVersions {
+
+	#define PAGE_VERSION_STRIPES 16384
+
+public:
+
+	static Version& Of(PageID pid) { return versions[(unsigned)pid % PAGE_VERSION_STRIPES]; }
+
+private:
+
+	static Version versions[PAGE_VERSION_STRIPES];
+};
+
+
+// Epoch-based reclamation of freed pages.  A thread enters an epoch
+// for each operation on a thread-safe tree and leaves it after; a scan
+// is in one only for each GetNext, and checks the versions of its
+// pages between calls instead.  A page freed in an epoch is retired:
+// it stays allocated until every thread that was in an epoch when it
+// was retired has left, as such a thread may still be reading the page
+// without a latch.  A page freed outside an epoch, as by a tree that
+// is not thread safe, is given back at once.  Entering and leaving
+// only write the thread's own slot.
+class Epochs {
+
+public:
+
+	static void Enter();
+	static void Exit();
+	static bool Retiring() { return owner.depth > 0; }
+	static void Retire(PageID pid);
+	static void Reclaim();
+
+private:
+
+	// What a thread's slot holds while it is in no epoch.
+	#define EPOCH_IDLE (~0UL)
+
+	// Slots are taken by threads when they first enter, and given back
+	// as they end.  They are never freed.
+	struct Slot {
+		std::atomic<unsigned long> epoch;
+		bool used;
+		Slot *next;
+	};
+
+	struct Owner {
+		Slot *slot;
+		int depth;
+		Owner() : slot(nullptr), depth(0) {}
+		~Owner();
+	};
+
+	struct Retired {
+		unsigned long epoch;
+		PageID pid;
+	};
+
+	static Slot* TakeSlot();
+
+	static std::atomic<unsigned long> global;
+	static std::atomic<int> numRetired;
+	static std::mutex mutex;
+	static Slot *slots;
+	static std::vector<Retired> retired;
+	static thread_local Owner owner;
+};
+
+
+// Holds the calling thread in an epoch until the end of a scope, if
+// active.
+class EpochGuard {
+
+public:
+
+	EpochGuard(bool active) : active(active) { if (active) Epochs::Enter(); }
+	~EpochGuard() { if (active) Epochs::Exit(); }
+
+private:
+
+	bool active;
+};
+
+
+class Snapshot;
+
+// The buffer manager is not thread safe, and is shared by all trees.
+// While any tree is open in thread-safe mode, the PIN, UNPIN, NEWPAGE
+// and FREEPAGE macros call it under one lock, for the other trees as
+// well.  A writer of a tree with open snapshots has the pages it pins
+// or frees preserved for them first.  A page freed in an epoch is
+// retired rather than given back at once.
+class BufferLatch {
+
+public:
+
+	// Count the thread-safe trees open.
+	static void Enable() { enabled++; }
+	static void Disable() { enabled--; }
+
+	static Status PinPage(PageID pid, Page*& page);
+	static Status UnpinPage(PageID pid, bool dirty);
+	static Status NewPage(PageID& pid, Page*& page);
+	static Status FreePage(PageID pid);
+	static Status CopyPage(PageID pid, Page& copy, Snapshot* asOf = nullptr);
+
+	// Count the pages the calling thread has pinned, copies included.
+	static long Pins() { return pins; }
+
+private:
+
+	friend class Epochs;
+
+	static Status Deallocate(PageID pid);
+
+	static std::mutex mutex;
+	static std::atomic<int> enabled;
+	static thread_local long pins;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "minirel.h"
+#include "page.h"
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+class Snapshots;
+
+// The pages of a tree as they were when the snapshot was opened.  A
+// page that writers have pinned or freed since is kept here as it
+// was; any other page is still as it was, and is read from the
+// buffer pool.
+class Snapshot {
+
+public:
+
+	Status Read(PageID pid, Page& copy);
+
+private:
+
+	friend class Snapshots;
+	friend class BufferLatch;
+
+	Snapshots *owner;
+	std::unordered_map<PageID, Page*> preImages;
+
+	bool Find(PageID pid, Page& copy);
+};
+
+
+// The open snapshots of a tree.  A thread that may change the tree
+// holds a Writer while it does.  Before such a thread gets a page
+// pinned or freed, the page is copied into every open snapshot that
+// has no copy of it yet.  A page pinned only to be read costs a copy
+// too many, which is undone when its snapshots close.
+class Snapshots {
+
+public:
+
+	Snapshots() : numOpen(0) {}
+	~Snapshots();
+
+	// A snapshot is opened while no writer of the tree is in, so that
+	// no page is changing.  It may be closed at any time.
+	Snapshot* Open();
+	void Close(Snapshot *snapshot);
+
+	// Marks the calling thread as a writer of a tree for a scope.
+	class Writer {
+
+	public:
+
+		Writer(Snapshots& snapshots) : previous(writing) { writing = &snapshots; }
+		~Writer() { writing = previous; }
+
+	private:
+
+		Snapshots *previous;
+	};
+
+	// Whether the calling thread is a writer of a tree with open
+	// snapshots, and so has to preserve the pages it pins or frees.
+	static bool Preserving()
+	{
+		return (writing != nullptr) && (writing->numOpen.load(std::memory_order_relaxed) > 0);
+	}
+
+	static void Preserve(PageID pid, const Page *page);
+
+	// The number of copies the open snapshots of all trees keep.
+	static long NumPreserved() { return numPreserved; }
+
+private:
+
+	friend class Snapshot;
+
+	static thread_local Snapshots *writing;
+	static std::atomic<long> numPreserved;
+
+	std::mutex mutex;
+	std::atomic<int> numOpen;
+	std::vector<Snapshot*> open;
+};
+
+#endif
@@ -8,6 +8,30 @@
 #include "bt.h"
 
 
+// Node layouts, kept in the high byte of the page type.  Pages written
+// before the dense layout existed have no format bits set.
+#define SLOTTED_FORMAT 0
+#define DENSE_FORMAT 1
+#define PACKED_FORMAT 2
+
+// Set, above the format bits, on a node split while the new right
+// sibling is not in the parent yet.
+#define SPLIT_PENDING 0x40
+
+// Space behind the page header that a dense node uses for its arrays,
+// i.e. the slot directory and the data area of the slotted layout.
+const int DENSE_AREA_SIZE = (MAX_SPACE - 3 * sizeof(PageID) - 4 * sizeof(short));
+
+// A search kernel over the sorted key array of a dense node.  Each
+// function returns how many of the first numKeys keys are less than
+// (lowerBound) or not greater than (upperBound) key.
+struct KeySearchKernel {
+	const char *name;
+	int (*lowerBound)(const int *keys, int numKeys, int key);
+	int (*upperBound)(const int *keys, int numKeys, int key);
+};
+
+
 class SortedPage : public HeapPage {
 	
 private:
@@ -19,9 +43,50 @@ public:
 	Status InsertRecord(char * recPtr, int recLen, RecordID& rid);	
 	Status DeleteRecord(const RecordID& rid);
 	
-	void  SetType(short t)  { type = t; }
-	short GetType()         { return type; }
+	// A page given a node type is a new node and uses the dense format.
+	void  SetType(short t)  { type = t | (DENSE_FORMAT << 8); }
+	short GetType()         { return type & 0xff; }
+	int   GetFormat()       { return (type >> 8) & ~SPLIT_PENDING & 0xff; }
+	void  SetFormat(int f)  { type = (type & (0xff | (SPLIT_PENDING << 8))) | (f << 8); }
 	int   GetNumOfRecords() { return numOfSlots; }
+
+	// A node whose split is pending holds the keys below its high key,
+	// and its next page holds the rest until the parent takes the new
+	// separator.  The high key is kept where a slotted page keeps
+	// fillPtr and freeSpace, which a split node, being dense or packed,
+	// does not use, and is only read while the split is pending.
+	bool  SplitPending()    { return (type & (SPLIT_PENDING << 8)) != 0; }
+	int   GetHighKey()      { return (int)(((unsigned int)(unsigned short)fillPtr << 16) | (unsigned short)freeSpace); }
+	void  SetSplitPending(int highKey)
+	{
+		fillPtr = (short)((unsigned int)highKey >> 16);
+		freeSpace = (short)highKey;
+		type |= (SPLIT_PENDING << 8);
+	}
+	void  ClearSplitPending() { type &= ~(SPLIT_PENDING << 8); }
+
+	// Whether key is past the high key of a node whose split is pending,
+	// so that it belongs to the next page.
+	bool  Beyond(const int key) { return SplitPending() && (key >= GetHighKey()); }
+
+	// The sorted keys of a dense node, one per record.
+	int*  DenseKeys()       { return (int *)slots; }
+
+	// Dense and slotted nodes only.  BTLeafPage hides these with
+	// versions that also read its packed format.
+	int   GetKey(int slotNo);
+	int   LowerBound(const int key);
+	int   UpperBound(const int key);
+
+	// The kernels this CPU can run, slowest first, and the one used by
+	// LowerBound/UpperBound.  The best kernel is picked on first use.
+	static const KeySearchKernel* GetSearchKernels(int& numKernels);
+	static const KeySearchKernel* GetSearchKernel();
+	static void SetSearchKernel(const KeySearchKernel* kernel);
+
+protected:
+
+	int   MoveUpperTo(SortedPage& dst, int keep, int capacity, int valueSize);
 };
 
 #endif
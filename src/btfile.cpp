@@ -4,23 +4,34 @@
 #include "new_error.h"
 #include "btfile.h"
 #include "btfilescan.h"
+#include <climits>
 
 //-------------------------------------------------------------------
 // BTreeFile::BTreeFile
 //
 // Input   : filename - filename of an index.
+//           threadSafe - let several threads use the tree at once.
 // Output  : returnStatus - status of execution of constructor.
 //           OK if successful, FAIL otherwise.
 // Purpose : If the B+ tree exists, open it.  Otherwise create a
 //           new B+ tree index.
+// Note    : A thread-safe tree has to be opened before the threads
+//           that use it start, as it turns on the buffer manager lock.
 //-------------------------------------------------------------------
 
-BTreeFile::BTreeFile (Status& returnStatus, const char* filename)
+BTreeFile::BTreeFile (Status& returnStatus, const char* filename, bool threadSafe)
 {
     Page * page ;
     Status getentry_state, newpage_state, addentry_state, pinpage_state;
 
     dbname = strcpy(new char[strlen(filename) + 1], filename);
+    lastLeaf.pid = INVALID_PAGE;
+    this->threadSafe = threadSafe;
+    if (threadSafe)
+        BufferLatch::Enable();
+    mergeFill = DEFAULT_MERGE_FILL;
+    redistributeFill = DEFAULT_REDISTRIBUTE_FILL;
+    counters = RebalanceCounters();
 
     getentry_state = MINIBASE_DB->GetFileEntry(filename, rootPid);
     if(getentry_state==FAIL)
@@ -67,6 +78,8 @@ BTreeFile::BTreeFile (Status& returnStatus, const char* filename)
 // Input   : None
 // Output  : None
 // Purpose : Clean Up
+// Note    : A thread-safe tree frees what it retired that no thread can
+//           still read, and stops counting towards the buffer latch.
 //-------------------------------------------------------------------
 
 BTreeFile::~BTreeFile()
@@ -74,12 +87,11 @@ BTreeFile::~BTreeFile()
     Status status;
     rootPid = INVALID_PAGE;
     delete [] dbname;
-}
-
-
-void BTreeFile::clearPath()
-{
-    path = stack<PageID>();
+    if (threadSafe)
+    {
+        Epochs::Reclaim();
+        BufferLatch::Disable();
+    }
 }
 
 //-------------------------------------------------------------------
@@ -95,10 +107,12 @@ void BTreeFile::clearPath()
 Status
 BTreeFile::DestroyFile()
 {
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
     Status status= OK;
-    PageID rootPageID;
-    SortedPage* rootPage;
-    short nType;
+
+    ForgetLastLeaf();
     if (rootPid == INVALID_PAGE)
     {
 		status = MINIBASE_DB->DeleteFileEntry(dbname);
@@ -108,17 +122,9 @@ BTreeFile::DestroyFile()
 	}
 	else
     {
-		PIN(rootPid,(Page *&)rootPage);
-		if( rootPage->GetType()==LEAF_NODE) {
-            UNPIN(rootPid, CLEAN);
-			FREEPAGE(rootPid);
-		}
-		else {
-            UNPIN(rootPid, CLEAN);
-			status=DestroyAll(rootPid);
-            if(status==FAIL)
-                return status;
-		}
+		status=DestroyAll(rootPid);
+        if(status==FAIL)
+            return status;
 	}
 
 	rootPid = INVALID_PAGE;
@@ -133,7 +139,8 @@ BTreeFile::DestroyFile()
 // Input   : None
 // Output  : None
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Recursively delete all the nodes
+// Purpose : Recursively delete all the nodes, and the posting lists
+//           of the leaves.
 //-------------------------------------------------------------------
 
 Status BTreeFile::DestroyAll(PageID pageID)
@@ -160,10 +167,15 @@ Status BTreeFile::DestroyAll(PageID pageID)
 			DestroyAll(curPageID);
 			s = ((BTIndexPage*&)page)->GetNext(key, curPageID, curRid);
 		}
-
-        UNPIN(pageID, CLEAN);
-
-        return s;
+	}
+	else
+	{
+		for (int i = 0; i < page->GetNumOfRecords(); i++)
+		{
+			RecordID dataRid = ((BTLeafPage *)page)->GetEntry(i).rid;
+			if (IsPostingList(dataRid))
+				FreePostingList(dataRid);
+		}
 	}
 
     UNPIN(pageID, CLEAN);
@@ -181,877 +193,3414 @@ Status BTreeFile::DestroyAll(PageID pageID)
 // Output  : None
 // Return  : OK if successful, FAIL otherwise.
 // Purpose : Insert an index entry with this rid and key.
-// Note    : If the root didn't exist, create it.
+// Note    : See InsertEntry.
 //-------------------------------------------------------------------
 
 
 Status
 BTreeFile::Insert(const int key, const RecordID rid)
 {
-    Status status;
-    SortedPage * rootPage ;
-    BTLeafPage * leafpage ;
-    BTIndexPage * indexpage;
-    RecordID outRid;
-    PageID leafPid, indexPid, outPid;
-    clearPath();
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
+    Snapshots::Writer writer(snapshots);
+    return InsertEntry(key, rid, KEEP_BOTH, threadSafe);
+}
 
-    short type;
-    if (rootPid == INVALID_PAGE)
-    {
-        Page * page ;
-        MINIBASE_BM -> NewPage ( rootPid , (Page *&)rootPage);
-        rootPage -> Init ( rootPid );
-        rootPage -> SetType (LEAF_NODE);
-    }
-    else
-    {
-        PIN(rootPid, (Page *&)rootPage);
-    }
+//-------------------------------------------------------------------
+// BTreeFile::InsertIfAbsent
+//
+// Input   : key - the value of the key to be inserted.
+//           rid - RecordID of the record to be inserted.
+// Output  : None
+// Return  : OK if inserted, DONE if key is already in the tree and
+//           nothing was changed, FAIL otherwise.
+// Purpose : Insert an index entry unless its key is taken.
+//-------------------------------------------------------------------
+
+Status
+BTreeFile::InsertIfAbsent(const int key, const RecordID rid)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
+    Snapshots::Writer writer(snapshots);
+    return InsertEntry(key, rid, KEEP_OLD, threadSafe);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::Upsert
+//
+// Input   : key - the value of the key to be inserted.
+//           rid - RecordID of the record to be inserted.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Point key at rid, replacing the record ids of key if it
+//           is in the tree and inserting it otherwise.
+//-------------------------------------------------------------------
+
+Status
+BTreeFile::Upsert(const int key, const RecordID rid)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
+    Snapshots::Writer writer(snapshots);
+    return InsertEntry(key, rid, REPLACE_OLD, threadSafe);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::InsertEntry
+//
+// Input   : key - the value of the key to be inserted.
+//           rid - RecordID of the record to be inserted.
+//           existing - what to do if key is already in the tree.
+//           latch - latch pages on the way, in thread-safe mode.
+// Output  : None
+// Return  : OK if successful, DONE if an existing key was kept,
+//           FAIL otherwise.
+// Purpose : Locate the leaf for key once, then check for key, insert
+//           or replace on that leaf while it is pinned.
+// Note    : If the root didn't exist, create it.  A key inside the
+//           bounds of the leaf of the last insert goes straight to
+//           that leaf, without pinning any index page.  A key that is
+//           already there gets rid added to its posting list.  A leaf
+//           that has no room for the change gets room from a sibling
+//           or is split, and the change is tried again on the leaf that
+//           now covers key.  A latching insert holds the leaf alone,
+//           and splits it without taking room from a sibling; see
+//           SplitLinked.
+//-------------------------------------------------------------------
 
-    type = rootPage->GetType();
+Status
+BTreeFile::InsertEntry(const int key, const RecordID rid, ExistingKey existing, bool latch)
+{
+    SortedPage * rootPage ;
+    BTLeafPage * leafPage ;
+    PageID leafPid;
+    Status status;
+    bool placed;
 
-    /* If root is leaf page, insert into root. Or search for the node to insert*/
-    if(type == LEAF_NODE)
+    for (;;)
     {
-        leafpage = (BTLeafPage* &)rootPage;
-        leafPid = rootPid;
-        PageID newRootPageID;
+        TreePath path;
 
-        if(leafpage -> AvailableSpace () >= INSERTSIZE)
+        if (latch)
+            path.StartLatching(&rootLatch, &rootVersion, LATCH_EXCLUSIVE);
+        path.LatchRoot();
+        if (rootPid == INVALID_PAGE)
         {
-            leafpage -> Insert ( key , rid , outRid );
-
-            UNPIN(leafPid, DIRTY);
+            path.WriteRoot();
+            NEWPAGE(rootPid, rootPage);
+            rootPage -> Init ( rootPid );
+            rootPage -> SetType (LEAF_NODE);
+            UNPIN(rootPid, DIRTY);
         }
-        else
+
+        if ((lastLeaf.pid != INVALID_PAGE) && lastLeaf.Covers(key))
         {
-            UNPIN(leafPid, DIRTY);
-            SplitLeafNode(leafPid, rootPid, key, rid);
+            PIN(lastLeaf.pid, leafPage);
+            status = InsertIntoLeaf(lastLeaf.pid, leafPage, key, rid, existing, placed);
+            if ((status != OK) || placed)
+                return status;
+        }
+
+        if (Descend<InsertOp>(key, path, leafPid, leafPage) != OK)
+            return FAIL;
+        if (path.Latching())
+            path.UnlatchAbove();
 
+        status = InsertIntoLeaf(leafPid, leafPage, key, rid, existing, placed);
+        if ((status != OK) || placed)
+        {
+            if (status == OK)
+                RememberLeaf(leafPid, path.hasLow, path.lowKey, path.hasHigh, path.highKey);
+            return status;
         }
+
+        // Making room remembers the leaf that covers key.
+        status = path.Latching() ? SplitLinked(leafPid, path, key) : MakeRoom(leafPid, path, key, rid);
+        if (status != OK)
+            return FAIL;
     }
-    else
-    {
-        indexPid = rootPid;
-        UNPIN(rootPid, CLEAN);
-        IndexSearch(indexPid, key, rid, outPid, "insert");
-    }
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::InsertIntoLeaf
+//
+// Input   : leafPid, leafPage - the pinned leaf whose range holds key.
+//           key - the value of the key to be inserted.
+//           rid - RecordID of the record to be inserted.
+//           existing - what to do if key is already on the leaf.
+// Output  : placed - false if the leaf has no room for the change,
+//                    so that it has to be split.
+// Return  : OK if successful, DONE if an existing key was kept,
+//           FAIL otherwise.
+// Purpose : Do the leaf part of InsertEntry.  The leaf is unpinned.
+//-------------------------------------------------------------------
 
+Status BTreeFile::InsertIntoLeaf(PageID leafPid, BTLeafPage *leafPage, const int key,
+                                 const RecordID rid, ExistingKey existing, bool& placed)
+{
+    int slotNo;
+    bool newEntry;
 
-    return OK;
+    Status status = AddToLeaf(leafPage, key, rid, existing, slotNo, newEntry, placed);
+    UNPIN(leafPid, ((status != DONE) && placed) ? DIRTY : CLEAN);
+    return status;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::SplitLeafNode
+// BTreeFile::AddToLeaf
 //
-// Input   : key - the value of the key to be inserted.
+// Input   : leafPage - the pinned leaf whose range holds key.
+//           key - the value of the key to be inserted.
 //           rid - RecordID of the record to be inserted.
-//           leafPageID - the leaf page to be split
-//           newRootPageID - the parent page id for the leaf page
-// Output  : None
-// Return  : OK if successful, FAIL otherwise.
-// Purpose : Split the leaf page when it is full.
-// Note    : A index key will be inserted into parent page.
-//           A new leaf page will be created.
+//           existing - what to do if key is already on the leaf.
+// Output  : slotNo - the position of the entry of key on the leaf.
+//           newEntry - true if the entry of key was inserted.
+//           placed - false if the leaf has no room for the change, in
+//                    which case nothing was changed.
+// Return  : OK if successful, DONE if an existing key was kept,
+//           FAIL otherwise.
+// Purpose : Add rid under key on the leaf, which is left pinned.
 //-------------------------------------------------------------------
 
-Status BTreeFile::SplitLeafNode(PageID leafPageID, PageID& parentPageID, const int key, const RecordID rid)
+Status BTreeFile::AddToLeaf(BTLeafPage *leafPage, const int key, const RecordID rid,
+                            ExistingKey existing, int& slotNo, bool& newEntry, bool& placed)
 {
-    BTIndexPage* parentPage;
-    BTLeafPage *leafPage;
-    PageID newLeafPageID;
-    BTLeafPage* newLeafPage;
-    int firstKey;
-    RecordID firstRid, outRid;
-    Status pin_status = FAIL;
-    Status left_insert = FAIL;
+    RecordID outRid, dataRid;
+
+    slotNo = leafPage->LowerBound(key);
+    newEntry = false;
+    placed = true;
 
-    if(leafPageID == rootPid)
+    if ((slotNo < leafPage->GetNumOfRecords()) && (leafPage->GetKey(slotNo) == key))
     {
-        MINIBASE_BM ->NewPage(parentPageID, (Page *&)parentPage);
-    	parentPage->SetType(INDEX_NODE);
-    	parentPage->Init(parentPageID);
+        dataRid = leafPage->GetEntry(slotNo).rid;
+        if (existing == KEEP_OLD)
+            return DONE;
+        if (existing == KEEP_BOTH)
+            return AddToPostingList(leafPage, slotNo, rid, placed);
+
+        if (!leafPage->CanSetDataRid(slotNo, rid))
+        {
+            placed = false;
+            return OK;
+        }
+        if (IsPostingList(dataRid) && (FreePostingList(dataRid) != OK))
+            return FAIL;
+        return leafPage->SetDataRid(slotNo, rid);
     }
-    else
+
+    /* Insert into the leaf if it has room, otherwise split it. */
+    if (!leafPage->HasRoomFor(key, rid))
     {
-        MINIBASE_BM->PinPage(parentPageID, (Page *&)parentPage);
+        placed = false;
+        return OK;
     }
 
-    MINIBASE_BM ->NewPage(newLeafPageID, (Page *&)newLeafPage);
-	newLeafPage->SetType(LEAF_NODE);
-	newLeafPage->Init(newLeafPageID);
-
-    PIN(leafPageID, (Page *&)leafPage);
-    int totalSize = (HEAPPAGE_DATA_SIZE - leafPage->AvailableSpace())/INSERTSIZE;
+    INSERT(leafPage, key, rid, outRid);
+    slotNo = outRid.slotNo;
+    newEntry = true;
+    return OK;
+}
 
-    for (int i = 0; i < totalSize/2; i++) {
-       leafPage -> GetLast(firstKey, firstRid, outRid);
-       newLeafPage -> Insert ( firstKey , firstRid , outRid );
-       leafPage -> Delete(firstKey, firstRid, outRid);
-    }
+//-------------------------------------------------------------------
+// BTreeFile::Insert
+//
+// Input   : key - the value of the key to be inserted.
+//           rid - RecordID of the record to be inserted.
+//           hint - an open scan of this index, positioned near key.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Insert an index entry, starting from the leaf the scan
+//           is on.
+// Note    : Leaves carry no fence keys, so the leaf's first and last
+//           keys stand in for them: a key between the two, or past an
+//           end of the leaf chain, must belong to the leaf.  If it
+//           cannot be shown to, or the leaf is full, the insert
+//           descends from the root and the scan is positioned again.
+//           So is a scan inside the posting list that rid joins.
+//           A snapshot scan is no hint, as its leaf is a copy.
+//-------------------------------------------------------------------
 
-    newLeafPage -> GetFirst(firstKey,  firstRid, outRid);
+Status
+BTreeFile::Insert(const int key, const RecordID rid, IndexFileScan* hint)
+{
+    BTreeFileScan *scan = (BTreeFileScan *)hint;
+    BTLeafPage *leafPage;
+    Status status;
+    int slotNo;
+    bool newEntry, placed;
 
-    if(key>firstKey)
-    {
-        newLeafPage-> Insert ( key , rid , outRid );
-    }
-    else
-    {
-        leafPage-> Insert ( key , rid , outRid );
-    }
+    if ((scan == nullptr) || (scan->btf != this) || (scan->snapshot != nullptr))
+        return Insert(key, rid);
 
-    if(parentPage-> AvailableSpace () >= INDEXENTRYSIZE)
-    {
-        parentPage -> Insert ( firstKey , newLeafPageID , outRid );
-        if(outRid.slotNo==0)
-            parentPage->SetLeftLink(leafPageID);
-        UNPIN(parentPageID, DIRTY);
-    }
-    else
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
+    if (scan->scanPid != INVALID_PAGE)
     {
-        UNPIN(parentPageID, DIRTY);
-        SplitIndex(parentPageID, firstKey, newLeafPageID);
+        PIN(scan->scanPid, leafPage);
+        if ((leafPage->GetType() == LEAF_NODE) && LeafHolds(leafPage, key))
+        {
+            status = AddToLeaf(leafPage, key, rid, KEEP_BOTH, slotNo, newEntry, placed);
+            if ((status != OK) || placed)
+            {
+                UNPIN(scan->scanPid, DIRTY);
+                if (status != OK)
+                    return status;
+                if (newEntry)
+                    scan->EntryInserted(slotNo, key);
+                else if (slotNo == scan->scanRid.slotNo)
+                    return RepositionScan(scan);
+                scan->RememberPages();
+                return OK;
+            }
+        }
+        UNPIN(scan->scanPid, CLEAN);
     }
 
-    if(rootPid == leafPageID)
-    {
-        rootPid = parentPageID;
-    }
+    if (InsertEntry(key, rid, KEEP_BOTH, false) != OK)
+        return FAIL;
+    return RepositionScan(scan);
+}
 
+//-------------------------------------------------------------------
+// BTreeFile::LeafHolds
+//
+// Input   : leafPage - a pinned leaf.
+//           key - the key to check.
+// Output  : None
+// Return  : True if key is known to fall in the range of the leaf.
+// Purpose : Check a leaf that was not reached by a descent.
+//-------------------------------------------------------------------
 
-    leafPage->SetNextPage(newLeafPageID);
-    newLeafPage->SetPrevPage(leafPageID);
+bool BTreeFile::LeafHolds(BTLeafPage *leafPage, const int key)
+{
+    int numRecords = leafPage->GetNumOfRecords();
 
-    UNPIN(leafPageID, DIRTY);
-	UNPIN(newLeafPageID, DIRTY);
+    if (numRecords == 0)
+        return (leafPage->GetPrevPage() == INVALID_PAGE) && (leafPage->GetNextPage() == INVALID_PAGE);
 
-    return OK;
+    return ((key >= leafPage->GetKey(0)) || (leafPage->GetPrevPage() == INVALID_PAGE))
+        && ((key <= leafPage->GetKey(numRecords - 1)) || (leafPage->GetNextPage() == INVALID_PAGE));
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::SplitIndex
+// BTreeFile::SplitLeafNode
 //
-// Input   : key - the value of the key to be inserted.
-//           pid - PageID of the record to be inserted.
-//           prevIndexPageID - the index page to be split
+// Input   : key - the key that has no room on the leaf.
+//           leafPageID - the leaf page to be split
+//           path - the index pages above the leaf page
 // Output  : None
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Split the index page when it is full.
-// Note    : A index key will be inserted into parent page.
-//           A new index page will be created.
+// Purpose : Split the leaf page when it has no room for a change to
+//           key.  The half that covers key is remembered as the leaf
+//           of the last insert, for the change to be made there.
+// Note    : A index key will be inserted into parent page.  See
+//           SplitLeafPage.
 //-------------------------------------------------------------------
 
-Status BTreeFile::SplitIndex(PageID prevIndexPageID, const int key, const PageID pid)
+Status BTreeFile::SplitLeafNode(PageID leafPageID, TreePath& path, const int key)
 {
-    SortedPage *test;
-    BTIndexPage* prevIndexPage, *parentPage;
-    BTIndexPage* newIndexPage;
-    PageID newIndexPageID, parentPageID, lastPid, firstPid;
+    BTIndexPage* parentPage;
+    PageID parentPageID, newLeafPageID;
+    int firstKey;
+    bool append;
     RecordID outRid;
-    int lastKey, firstKey;
 
-    path.pop();
-    if(prevIndexPageID == rootPid)
+    if(path.depth == 0)
     {
-        MINIBASE_BM -> NewPage(parentPageID, (Page *&)parentPage);
-    	parentPage -> SetType(INDEX_NODE);
-    	parentPage -> Init(parentPageID);
+        NEWPAGE(parentPageID, parentPage);
+    	parentPage->Init(parentPageID);
+    	parentPage->SetType(INDEX_NODE);
+        parentPage->SetLeftLink(leafPageID);
+        path.WriteRoot();
         rootPid = parentPageID;
-        parentPage -> SetLeftLink(prevIndexPageID);
+        path.pids[path.depth++] = parentPageID;
     }
     else
     {
-        parentPageID = path.top();
-
-        PIN(parentPageID, (Page *&)parentPage);
+        parentPageID = path.Parent();
+        PIN(parentPageID, parentPage);
     }
 
-    MINIBASE_BM ->NewPage(newIndexPageID, (Page *&)newIndexPage);
-    newIndexPage->SetType(INDEX_NODE);
-    newIndexPage->Init(newIndexPageID);
-
-    PIN(prevIndexPageID, (Page *&)prevIndexPage);
-
-    int totalSize = (HEAPPAGE_DATA_SIZE - prevIndexPage->AvailableSpace())/INDEXENTRYSIZE;
-
-    for (int i = 0; i < totalSize/2; i++) {
-       prevIndexPage -> GetLast(lastKey, lastPid, outRid);
-       newIndexPage -> Insert ( lastKey , lastPid , outRid );
-       prevIndexPage -> Delete(lastKey, outRid);
+    if (SplitLeafPage(leafPageID, path, key, false, newLeafPageID, firstKey, append) != OK)
+    {
+        UNPIN(parentPageID, CLEAN);
+        return FAIL;
     }
 
-    newIndexPage -> GetFirst(firstKey,  firstPid, outRid);
-
-    if(key>firstKey)
-        newIndexPage-> Insert ( key , pid , outRid );
+    if(key>=firstKey)
+        RememberLeaf(newLeafPageID, true, firstKey, path.hasHigh, path.highKey);
     else
-        prevIndexPage-> Insert ( key , pid , outRid );
-
-    newIndexPage -> GetFirst(firstKey,  firstPid, outRid);
+        RememberLeaf(leafPageID, path.hasLow, path.lowKey, true, firstKey);
 
-    // If parent page has enough space, insert without split.
-    if(parentPage->AvailableSpace()>=INDEXENTRYSIZE)
+    if(!parentPage-> IsFull ())
     {
-        parentPage-> Insert ( firstKey , newIndexPageID , outRid );
-        newIndexPage-> Delete(firstKey, outRid);
-
-        newIndexPage -> SetLeftLink(firstPid);
+        path.WritePage(parentPageID);
+        INSERT(parentPage, firstKey, newLeafPageID, outRid);
         UNPIN(parentPageID, DIRTY);
-        UNPIN(prevIndexPageID, DIRTY);
-        UNPIN(newIndexPageID, DIRTY);
         return OK;
     }
-    // Recursively split the parent page if it's full.
+
+    UNPIN(parentPageID, CLEAN);
+    return SplitIndex(path, firstKey, newLeafPageID, append);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::SplitLeafPage
+//
+// Input   : leafPageID - the leaf page to be split
+//           path - the index pages above the leaf page
+//           key - the key that has no room on the leaf.
+//           pending - leave the split pending on the leaf, for the
+//                     parent to be told of it later.
+// Output  : newLeafPageID - the new leaf, right of the old one.
+//           firstKey - the separator of the two.
+//           append - whether this was an append, see below.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Move the upper entries of the leaf to a new leaf, spliced
+//           into the chain after it.  The parent is left to the caller.
+// Note    : A key beyond the end of the rightmost leaf is taken as
+//           part of an ascending load: the full leaf is left as it is
+//           and the new leaf is left empty for the key, instead of
+//           splitting the entries in half.
+//-------------------------------------------------------------------
+
+Status BTreeFile::SplitLeafPage(PageID leafPageID, TreePath& path, const int key, bool pending,
+                                PageID& newLeafPageID, int& firstKey, bool& append)
+{
+    BTLeafPage *leafPage;
+    BTLeafPage* newLeafPage;
+
+    NEWPAGE(newLeafPageID, newLeafPage);
+	newLeafPage->Init(newLeafPageID);
+	newLeafPage->SetType(LEAF_NODE);
+    COUNT(counters.leafSplits);
+
+    PIN(leafPageID, (Page *&)leafPage);
+    int numRecords = leafPage->GetNumOfRecords();
+    append = !path.hasHigh && (numRecords > 0)
+        && (key > leafPage->GetKey(numRecords - 1));
+
+    if(append)
+        firstKey = key;
     else
+        firstKey = leafPage->MoveUpperTo(*newLeafPage, numRecords - numRecords / 2);
+
+    // Splice the new leaf into the chain after the old one.
+    PageID nextLeafPageID = leafPage->GetNextPage();
+    leafPage->SetNextPage(newLeafPageID);
+    newLeafPage->SetPrevPage(leafPageID);
+    newLeafPage->SetNextPage(nextLeafPageID);
+    if(nextLeafPageID != INVALID_PAGE)
     {
-        newIndexPage-> Delete(firstKey, outRid);
-        newIndexPage -> SetLeftLink(firstPid);
-        UNPIN(parentPageID, DIRTY);
-        UNPIN(prevIndexPageID, DIRTY);
-        UNPIN(newIndexPageID, DIRTY);
-        SplitIndex(parentPageID, firstKey, newIndexPageID);
+        BTLeafPage *nextLeafPage;
+        path.LatchPage(nextLeafPageID);
+        PIN(nextLeafPageID, nextLeafPage);
+        nextLeafPage->SetPrevPage(newLeafPageID);
+        UNPIN(nextLeafPageID, DIRTY);
     }
+    if (pending)
+        leafPage->SetSplitPending(firstKey);
 
+    UNPIN(leafPageID, DIRTY);
+	UNPIN(newLeafPageID, DIRTY);
     return OK;
-
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::LeafInsert
+// BTreeFile::MakeRoom
 //
-// Input   : key - the value of the key to be inserted.
-//           rid - RecordID of the record to be inserted.
-//           childPid - the id of leaf page to be inserted
-//           indexPid - the id of parent page of inserted leaf page
+// Input   : leafPid - the leaf that has no room for a change to key.
+//           path - the index pages above the leaf.
+//           key, rid - the entry to be inserted.
 // Output  : None
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Insert into leaf page. If it's full, split it.
+// Purpose : Make room on a leaf for key, B*-tree style: entries are
+//           shifted into an adjacent sibling that has room.  If the
+//           leaf and its sibling are both full, the two are split into
+//           three.  The leaf that covers key afterwards is remembered
+//           as the leaf of the last insert.
+// Note    : A change to the record id of a key on the leaf, an append
+//           at the end of an ascending load, and a leaf without
+//           siblings under the same parent are split as before.
 //-------------------------------------------------------------------
 
-Status BTreeFile::LeafInsert(PageID childPid, PageID indexPid, const int key, const RecordID rid)
+Status BTreeFile::MakeRoom(PageID leafPid, TreePath& path, const int key, const RecordID rid)
 {
-    BTLeafPage *childLeafPage;
-    RecordID outRid;
-
-    PIN(childPid, (Page *&)childLeafPage);
+    BTLeafPage *leafPage;
+    BTIndexPage *parentPage;
+    PageID parentPid;
+    vector<int> keys;
+    vector<PageID> pids;
+    int separator;
+    size_t pos, leftPos;
+    bool shifted;
+
+    if (path.depth == 0)
+        return SplitLeafNode(leafPid, path, key);
+
+    PIN(leafPid, leafPage);
+    int numRecords = leafPage->GetNumOfRecords();
+    int slotNo = leafPage->LowerBound(key);
+    bool change = (slotNo < numRecords) && (leafPage->GetKey(slotNo) == key);
+    bool append = !path.hasHigh && (numRecords > 0)
+        && (key > leafPage->GetKey(numRecords - 1));
+    UNPIN(leafPid, CLEAN);
+
+    if (change || append)
+        return SplitLeafNode(leafPid, path, key);
+
+    parentPid = path.Parent();
+    PIN(parentPid, parentPage);
+    ReadIndexNode(parentPage, keys, pids);
+    pos = find(pids.begin(), pids.end(), leafPid) - pids.begin();
+    if ((pos == pids.size()) || (pids.size() < 2))
+    {
+        UNPIN(parentPid, CLEAN);
+        return SplitLeafNode(leafPid, path, key);
+    }
 
-    if(childLeafPage -> AvailableSpace () >= INSERTSIZE)
+    // Try the right sibling first, as the delete path does.
+    for (int i = 0; i < 2; i++)
     {
+        bool left = (i == 1);
+        if (left ? (pos == 0) : (pos + 1 == pids.size()))
+            continue;
+
+        // The right sibling is latched after the leaf, as the leaf chain
+        // runs, while the left one is only tried.
+        if (!left)
+            path.LatchPage(pids[pos + 1]);
+        else if (!path.TryLatchPage(pids[pos - 1]))
+            continue;
+
+        leftPos = left ? pos - 1 : pos;
+        if (ShiftToSibling(pids[leftPos], pids[leftPos + 1], key, rid, separator, shifted) != OK)
+        {
+            UNPIN(parentPid, CLEAN);
+            return FAIL;
+        }
+        if (!shifted)
+            continue;
+
+        path.WritePage(parentPid);
+        parentPage->changeKey(separator, keys[leftPos + 1]);
+        UNPIN(parentPid, DIRTY);
+        keys[leftPos + 1] = separator;
+
+        pos = (key < separator) ? leftPos : leftPos + 1;
+        RememberLeaf(pids[pos], (pos > 0) || path.hasLow, (pos > 0) ? keys[pos] : path.lowKey,
+                     (pos + 1 < pids.size()) || path.hasHigh,
+                     (pos + 1 < pids.size()) ? keys[pos + 1] : path.highKey);
+        return OK;
+    }
 
-        childLeafPage-> Insert ( key , rid , outRid );
+    UNPIN(parentPid, CLEAN);
+    leftPos = (pos + 1 < pids.size()) ? pos : pos - 1;
+    if (!path.Holds(pids[leftPos]))
+        return SplitLeafNode(leafPid, path, key);
+    return SplitLeafPair(path, keys, pids, leftPos, key);
+}
 
-        UNPIN(childPid, DIRTY);
-    }
-    else
+//-------------------------------------------------------------------
+// BTreeFile::ShiftToSibling
+//
+// Input   : leftPid, rightPid - two adjacent leaves under one parent.
+//           key, rid - the entry to be inserted into one of them.
+// Output  : separator - the new separator between the two leaves.
+//           shifted - false if the two leaves have no room for the
+//                     entry, in which case nothing was changed.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Even out the entries of two leaves so that the one that
+//           covers key has room for the entry.
+// Note    : The entry itself is not inserted.  The parent is left to
+//           the caller.
+//-------------------------------------------------------------------
+
+Status BTreeFile::ShiftToSibling(PageID leftPid, PageID rightPid, const int key,
+                                 const RecordID rid, int& separator, bool& shifted)
+{
+    BTLeafPage *leftPage, *rightPage;
+    int entryKeys[2 * LEAF_PACKED_CAPACITY + 1];
+    RecordID entryRids[2 * LEAF_PACKED_CAPACITY + 1];
+
+    PIN(leftPid, leftPage);
+    PIN(rightPid, rightPage);
+    int leftNum = leftPage->ReadEntries(entryKeys, entryRids);
+    int total = leftNum + rightPage->ReadEntries(entryKeys + leftNum, entryRids + leftNum);
+
+    // Lay the entries out with the new one, to find a split that has
+    // room for it.
+    int pos = upper_bound(entryKeys, entryKeys + total, key) - entryKeys;
+    memmove(entryKeys + pos + 1, entryKeys + pos, (total - pos) * sizeof(int));
+    memmove(entryRids + pos + 1, entryRids + pos, (total - pos) * sizeof(RecordID));
+    entryKeys[pos] = key;
+    entryRids[pos] = rid;
+
+    int split = EvenSplit(entryKeys, entryRids, total + 1);
+    shifted = (split > 0);
+    if (!shifted)
     {
-        UNPIN(childPid, DIRTY);
-        SplitLeafNode(childPid, indexPid, key, rid);
+        UNPIN(leftPid, CLEAN);
+        UNPIN(rightPid, CLEAN);
+        return OK;
     }
+    separator = entryKeys[split];
+
+    memmove(entryKeys + pos, entryKeys + pos + 1, (total - pos) * sizeof(int));
+    memmove(entryRids + pos, entryRids + pos + 1, (total - pos) * sizeof(RecordID));
+    if (pos < split)
+        split--;
+
+    leftPage->WriteEntries(entryKeys, entryRids, split);
+    rightPage->WriteEntries(entryKeys + split, entryRids + split, total - split);
+    UNPIN(leftPid, DIRTY);
+    UNPIN(rightPid, DIRTY);
+    COUNT(counters.leafRedistributions);
     return OK;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::IndexSearch
+// BTreeFile::SplitLeafPair
 //
-// Input   : key - the value of the key to be inserted.
-//           rid - RecordID of the record to be inserted.
-//           indexPid - the latest pid this recursive method
-//           flag - the operation to do (search, insert or delete)
-// Output  : outPid - the Pid of page contains the key. Used in openscan.
+// Input   : path - the index pages above the two leaves.
+//           keys, pids - their parent, in the form of ReadIndexNode.
+//           leftPos - the position of the left leaf in pids.
+//           key - the key that has no room on either leaf.
+// Output  : None
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Core function in this work. Recursively go through the Tree
-//           to achieve insert/search/delete operations based on flag.
-// Note    : path is a stack declared in BTreeFile class which is to store the
-//           index nodes the search has scaned (parents). Each time
-//           scan an index page, its pid will be pushed into stack
-//           so that the top of the stack is always the parent of
-//           current page.
-//-------------------------------------------------------------------
-
-Status BTreeFile::IndexSearch(PageID indexPid, const int key, const RecordID rid, PageID& outPid, string flag)
-{
-    int firstKey, nextKey, outKey;
-    PageID firstPid, childPid;
-    RecordID firstRid, nextRid, outRid;
-    BTLeafPage *childLeafPage;
-    BTIndexPage *childIndexPage;
-    SortedPage *childPage;
-    BTIndexPage *indexpage;
-    short type;
-    Status status;
-    PIN(indexPid,(Page *&)indexpage);
-    path.push(indexPid);
+// Purpose : Split two full adjacent leaves into three, each about two
+//           thirds full, as a B*-tree does.  The new leaf goes to the
+//           right of the pair.
+// Note    : If no three way split fits, the leaf of key is split in
+//           two instead.
+//-------------------------------------------------------------------
 
-    indexpage -> GetFirst(firstKey, firstPid, firstRid);
+Status BTreeFile::SplitLeafPair(TreePath& path, vector<int>& keys, vector<PageID>& pids,
+                                size_t leftPos, const int key)
+{
+    BTLeafPage *leftPage, *rightPage, *newPage, *nextPage;
+    BTIndexPage *parentPage;
+    PageID leftPid = pids[leftPos], rightPid = pids[leftPos + 1];
+    PageID parentPid = path.Parent(), newPid, nextPid;
+    int entryKeys[2 * LEAF_PACKED_CAPACITY];
+    RecordID entryRids[2 * LEAF_PACKED_CAPACITY];
+    int first = 0, second = 0;
+    RecordID outRid;
 
-    if(key<firstKey)
-    {
-        childPid = indexpage->GetLeftLink();
+    PIN(leftPid, leftPage);
+    PIN(rightPid, rightPage);
+    int leftNum = leftPage->ReadEntries(entryKeys, entryRids);
+    int total = leftNum + rightPage->ReadEntries(entryKeys + leftNum, entryRids + leftNum);
 
-    }
-    else
+    // Look for split points near the thirds at which all three fit.
+    for (int i = 0; (i < 2 * SPLIT_WINDOW_DIVISOR) && (second == 0); i++)
     {
-        status = OK;
-        while (status!=DONE) {
-            if(key==firstKey)
+        int p = total / 3 + ((i % 2 == 1) ? (i + 1) / 2 : -(i / 2));
+        for (int j = 0; (j < 2 * SPLIT_WINDOW_DIVISOR) && (second == 0); j++)
+        {
+            int q = total - total / 3 + ((j % 2 == 1) ? (j + 1) / 2 : -(j / 2));
+            if ((p >= 1) && (q > p) && (q < total)
+                && BTLeafPage::Fits(entryKeys, entryRids, p)
+                && BTLeafPage::Fits(entryKeys + p, entryRids + p, q - p)
+                && BTLeafPage::Fits(entryKeys + q, entryRids + q, total - q))
             {
-                childPid = firstPid;
-                break;
+                first = p;
+                second = q;
             }
-            if(key<firstKey)
-                break;
-            childPid = firstPid;
-            status = indexpage->GetNext(firstKey, firstPid, firstRid);
         }
     }
 
+    if (second == 0)
+    {
+        UNPIN(leftPid, CLEAN);
+        UNPIN(rightPid, CLEAN);
+        return SplitLeafNode((key < keys[leftPos + 1]) ? leftPid : rightPid, path, key);
+    }
 
-    PIN(childPid, (Page *&)childPage);
-
-    type = childPage->GetType();
+    NEWPAGE(newPid, newPage);
+    newPage->Init(newPid);
+    newPage->SetType(LEAF_NODE);
+    COUNT(counters.leafSplits);
+
+    leftPage->WriteEntries(entryKeys, entryRids, first);
+    rightPage->WriteEntries(entryKeys + first, entryRids + first, second - first);
+    newPage->WriteEntries(entryKeys + second, entryRids + second, total - second);
+
+    // Splice the new leaf into the chain after the right one.
+    nextPid = rightPage->GetNextPage();
+    rightPage->SetNextPage(newPid);
+    newPage->SetPrevPage(rightPid);
+    newPage->SetNextPage(nextPid);
+    if (nextPid != INVALID_PAGE)
+    {
+        path.LatchPage(nextPid);
+        PIN(nextPid, nextPage);
+        nextPage->SetPrevPage(newPid);
+        UNPIN(nextPid, DIRTY);
+    }
+    UNPIN(leftPid, DIRTY);
+    UNPIN(rightPid, DIRTY);
+    UNPIN(newPid, DIRTY);
+
+    int firstSeparator = entryKeys[first];
+    int secondSeparator = entryKeys[second];
+
+    // The three leaves cover the range of the pair, split at the two
+    // separators.
+    bool hasLow = (leftPos > 0) || path.hasLow;
+    int low = (leftPos > 0) ? keys[leftPos] : path.lowKey;
+    bool hasHigh = (leftPos + 2 < pids.size()) || path.hasHigh;
+    int high = (leftPos + 2 < pids.size()) ? keys[leftPos + 2] : path.highKey;
+    if (key < firstSeparator)
+        RememberLeaf(leftPid, hasLow, low, true, firstSeparator);
+    else if (key < secondSeparator)
+        RememberLeaf(rightPid, true, firstSeparator, true, secondSeparator);
+    else
+        RememberLeaf(newPid, true, secondSeparator, hasHigh, high);
 
-    if(type == LEAF_NODE)
+    PIN(parentPid, parentPage);
+    path.WritePage(parentPid);
+    parentPage->changeKey(firstSeparator, keys[leftPos + 1]);
+    if (!parentPage->IsFull())
     {
+        INSERT(parentPage, secondSeparator, newPid, outRid);
+        UNPIN(parentPid, DIRTY);
+        return OK;
+    }
 
-        if(flag == "insert")
+    UNPIN(parentPid, DIRTY);
+    return SplitIndex(path, secondSeparator, newPid, false);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::EvenSplit
+//
+// Input   : keys, rids - the entries of two adjacent leaves, in order.
+//           total - the number of entries.
+// Output  : None
+// Return  : The number of entries for the left leaf, or -1 if there
+//           is no split point at which both leaves fit.
+// Purpose : Share the entries of two leaves out as evenly as they fit.
+//           Neither leaf is left empty.
+//-------------------------------------------------------------------
+
+int BTreeFile::EvenSplit(const int *keys, const RecordID *rids, int total)
+{
+    for (int step = 0; step < total; step++)
+    {
+        int split = total / 2 + ((step % 2 == 1) ? (step + 1) / 2 : -(step / 2));
+        if ((split >= 1) && (split < total)
+            && BTLeafPage::Fits(keys, rids, split)
+            && BTLeafPage::Fits(keys + split, rids + split, total - split))
+            return split;
+    }
+    return -1;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::SplitIndex
+//
+// Input   : key - the value of the key to be inserted.
+//           pid - PageID of the record to be inserted.
+//           path - the index pages down to the page to be split,
+//                  which is the last one
+//           append - the child was split at the end of an ascending
+//                    load, so key goes past the end of this page.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Split the index page when it is full.
+// Note    : A index key will be inserted into parent page.  See
+//           SplitIndexPage.
+//-------------------------------------------------------------------
+
+Status BTreeFile::SplitIndex(TreePath& path, const int key, const PageID pid, bool append)
+{
+    BTIndexPage *parentPage;
+    PageID prevIndexPageID, newIndexPageID, parentPageID;
+    RecordID outRid;
+    int firstKey;
+
+    prevIndexPageID = path.pids[--path.depth];
+    if(path.depth == 0)
+    {
+        NEWPAGE(parentPageID, parentPage);
+    	parentPage -> Init(parentPageID);
+    	parentPage -> SetType(INDEX_NODE);
+        path.WriteRoot();
+        rootPid = parentPageID;
+        parentPage -> SetLeftLink(prevIndexPageID);
+        path.pids[path.depth++] = parentPageID;
+    }
+    else
+    {
+        parentPageID = path.Parent();
+
+        PIN(parentPageID, (Page *&)parentPage);
+    }
+
+    if (SplitIndexPage(prevIndexPageID, path, key, pid, append, false, newIndexPageID, firstKey) != OK)
+    {
+        UNPIN(parentPageID, CLEAN);
+        return FAIL;
+    }
+
+    // If parent page has enough space, insert without split.
+    if(!parentPage->IsFull())
+    {
+        path.WritePage(parentPageID);
+        INSERT(parentPage, firstKey, newIndexPageID, outRid);
+        UNPIN(parentPageID, DIRTY);
+        return OK;
+    }
+
+    // Recursively split the parent page if it's full.
+    UNPIN(parentPageID, CLEAN);
+    return SplitIndex(path, firstKey, newIndexPageID, append);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::SplitIndexPage
+//
+// Input   : prevIndexPageID - the full index page.
+//           path - a path that latches the page, if any.
+//           key - the value of the key to be inserted.
+//           pid - PageID of the record to be inserted.
+//           append - the child was split at the end of an ascending
+//                    load, so key goes past the end of this page.
+//           pending - leave the split pending on the page, for the
+//                     parent to be told of it later.
+// Output  : newIndexPageID - the new page, right of the old one.
+//           firstKey - the key that moves up to the parent.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Split the entries of the index page and the new one
+//           between it and a new page.  The parent is left to the
+//           caller.
+// Note    : On an append, only the last child moves to the new page,
+//           next to the new entry.  Otherwise the upper half of the
+//           entries moves in one block copy, and the first key of the
+//           new page moves up.
+//-------------------------------------------------------------------
+
+Status BTreeFile::SplitIndexPage(PageID prevIndexPageID, TreePath& path, const int key, const PageID pid,
+                                 bool append, bool pending, PageID& newIndexPageID, int& firstKey)
+{
+    BTIndexPage* prevIndexPage;
+    BTIndexPage* newIndexPage;
+    PageID firstPid;
+    RecordID outRid;
+
+    NEWPAGE(newIndexPageID, newIndexPage);
+    newIndexPage->Init(newIndexPageID);
+    newIndexPage->SetType(INDEX_NODE);
+    COUNT(counters.indexSplits);
+
+    PIN(prevIndexPageID, (Page *&)prevIndexPage);
+    path.WritePage(prevIndexPageID);
+
+    if(append)
+    {
+        // The last entry of the full page moves up and its child
+        // becomes the left link of the new page.
+        prevIndexPage -> GetLast(firstKey, firstPid, outRid);
+        prevIndexPage -> Delete(firstKey, outRid);
+        newIndexPage -> SetLeftLink(firstPid);
+        newIndexPage -> Insert ( key , pid , outRid );
+    }
+    else
+    {
+        int numRecords = prevIndexPage->GetNumOfRecords();
+        firstKey = prevIndexPage->MoveUpperTo(*newIndexPage, numRecords - numRecords / 2);
+
+        if(key>firstKey)
+            newIndexPage-> Insert ( key , pid , outRid );
+        else
+            prevIndexPage-> Insert ( key , pid , outRid );
+
+        // The first entry of the new page moves up; its child becomes the
+        // left link of the new page.
+        newIndexPage -> GetFirst(firstKey,  firstPid, outRid);
+        newIndexPage-> Delete(firstKey, outRid);
+        newIndexPage -> SetLeftLink(firstPid);
+    }
+    if (pending)
+    {
+        prevIndexPage->SetRightLink(newIndexPageID);
+        prevIndexPage->SetSplitPending(firstKey);
+    }
+
+    UNPIN(prevIndexPageID, DIRTY);
+    UNPIN(newIndexPageID, DIRTY);
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::SplitLinked
+//
+// Input   : leafPid - a leaf that has no room for a change to key.
+//           path - a latching path that holds the leaf alone.
+//           key - the key of the change.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Split the leaf B-link style, for the change to be tried
+//           again: the new leaf is linked to the right of the old one,
+//           which keeps the separator as its high key, and only then is
+//           the parent told of it, with the leaf let go of.
+// Note    : A leaf whose last split the parent has not been told of
+//           yet is not split again before it is.
+//-------------------------------------------------------------------
+
+Status BTreeFile::SplitLinked(PageID leafPid, TreePath& path, const int key)
+{
+    BTLeafPage *leafPage;
+    PageID newLeafPid;
+    int separator;
+    bool append, pending;
+
+    PIN(leafPid, leafPage);
+    pending = leafPage->SplitPending();
+    separator = leafPage->GetHighKey();
+    UNPIN(leafPid, CLEAN);
+
+    if (!pending && (SplitLeafPage(leafPid, path, key, true, newLeafPid, separator, append) != OK))
+        return FAIL;
+
+    path.UnlatchAll();
+    return FinishSplit(leafPid, separator);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::FinishSplit
+//
+// Input   : leftPid - a node whose split may be pending.
+//           separator - the high key it had when it was seen pending.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Tell the parent of a pending split: insert the separator
+//           and the new right sibling there, or above a split root.
+// Note    : The parent is found by walking down for the separator from
+//           the root, as the page above the node when it split may
+//           have split or moved its entries since.  A page whose own
+//           split is pending is left to the right if the separator is
+//           beyond its high key, and is told of it first if it is full.
+//           A full parent is split in turn, which is then finished the
+//           same way.  No more than a page and the one below it are
+//           latched at once.  Whoever finds the split still pending
+//           under the parent's latch finishes it, so that a writer that
+//           meets one can do it rather than wait; if it is already done
+//           nothing is changed.
+//-------------------------------------------------------------------
+
+Status BTreeFile::FinishSplit(PageID leftPid, int separator)
+{
+    SortedPage *page, *leftPage;
+    BTIndexPage *parentPage;
+    PageID pageID, childPid, rightPid, newPid;
+    RecordID outRid;
+    int slot, upKey;
+    bool found;
+
+    for (;;)
+    {
+        TreePath path;
+
+        if (threadSafe)
+            path.StartLatching(&rootLatch, &rootVersion, LATCH_EXCLUSIVE);
+        path.LatchRoot();
+        pageID = rootPid;
+        found = (pageID == leftPid);
+        page = nullptr;
+
+        while (!found)
+        {
+            path.LatchPage(pageID);
+            PIN(pageID, page);
+            path.UnlatchAbove();
+            if (page->GetType() != INDEX_NODE)
+            {
+                // The node is no longer a child on the way to separator,
+                // so its split is done.
+                UNPIN(pageID, CLEAN);
+                return OK;
+            }
+
+            parentPage = (BTIndexPage *)page;
+            if (parentPage->Beyond(separator))
+                childPid = parentPage->GetRightLink();
+            else
+            {
+                slot = parentPage->UpperBound(separator);
+                childPid = (slot == 0) ? parentPage->GetLeftLink() : parentPage->GetEntry(slot - 1).pid;
+                found = (childPid == leftPid);
+            }
+            if (!found)
+            {
+                UNPIN(pageID, CLEAN);
+                pageID = childPid;
+            }
+        }
+
+        path.LatchPage(leftPid);
+        PIN(leftPid, leftPage);
+        if (!leftPage->SplitPending() || (leftPage->GetHighKey() != separator))
+        {
+            UNPIN(leftPid, CLEAN);
+            if (page != nullptr)
+                UNPIN(pageID, CLEAN);
+            return OK;
+        }
+        rightPid = leftPage->GetNextPage();
+
+        if (page == nullptr)
+        {
+            // A split root gets a new root above it.
+            NEWPAGE(pageID, parentPage);
+            parentPage->Init(pageID);
+            parentPage->SetType(INDEX_NODE);
+            parentPage->SetLeftLink(leftPid);
+            INSERT(parentPage, separator, rightPid, outRid);
+            UNPIN(pageID, DIRTY);
+            path.WriteRoot();
+            rootPid = pageID;
+            return EndSplit(leftPid, leftPage, path);
+        }
+
+        parentPage = (BTIndexPage *)page;
+        if (!parentPage->IsFull())
+        {
+            path.WritePage(pageID);
+            INSERT(parentPage, separator, rightPid, outRid);
+            UNPIN(pageID, DIRTY);
+            return EndSplit(leftPid, leftPage, path);
+        }
+
+        if (parentPage->SplitPending())
+        {
+            upKey = parentPage->GetHighKey();
+            UNPIN(leftPid, CLEAN);
+            UNPIN(pageID, CLEAN);
+            path.UnlatchAll();
+            if (FinishSplit(pageID, upKey) != OK)
+                return FAIL;
+            continue;
+        }
+
+        UNPIN(pageID, CLEAN);
+        if ((SplitIndexPage(pageID, path, separator, rightPid, false, true, newPid, upKey) != OK)
+            || (EndSplit(leftPid, leftPage, path) != OK))
+            return FAIL;
+        leftPid = pageID;
+        separator = upKey;
+    }
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::EndSplit
+//
+// Input   : leftPid, leftPage - a pinned node whose pending split the
+//                               parent was just told of.
+//           path - a path that latches the node, if any.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Clear the pending split of the node, and unpin it.  An
+//           index page forgets its right link.
+//-------------------------------------------------------------------
+
+Status BTreeFile::EndSplit(PageID leftPid, SortedPage *leftPage, TreePath& path)
+{
+    if (leftPage->GetType() == INDEX_NODE)
+    {
+        path.WritePage(leftPid);
+        ((BTIndexPage *)leftPage)->SetRightLink(INVALID_PAGE);
+    }
+    leftPage->ClearSplitPending();
+    UNPIN(leftPid, DIRTY);
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::RememberLeaf
+//
+// Input   : leafPid - the leaf an entry was just inserted into.
+//           hasLow, low - the lowest key of its range, if bounded.
+//           hasHigh, high - the key just above its range, if bounded.
+// Output  : None
+// Return  : None
+// Purpose : Cache the leaf for the fast path of Insert.
+// Note    : A thread-safe tree keeps no cache, as the leaf may change
+//           under it without a latch.
+//-------------------------------------------------------------------
+
+void BTreeFile::RememberLeaf(PageID leafPid, bool hasLow, int low, bool hasHigh, int high)
+{
+    if (threadSafe)
+        return;
+
+    lastLeaf.pid = leafPid;
+    lastLeaf.hasLow = hasLow;
+    lastLeaf.low = low;
+    lastLeaf.hasHigh = hasHigh;
+    lastLeaf.high = high;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::NewNode
+//
+// Input   : type - LEAF_NODE or INDEX_NODE.
+//           reuseRoot - take over the current root page instead of
+//                       allocating a new one.
+// Output  : pageID - the id of the new node.
+//           page - the new node, pinned.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Allocate and initialize an empty node of the given type.
+//-------------------------------------------------------------------
+
+Status BTreeFile::NewNode(PageID& pageID, SortedPage*& page, short type, bool reuseRoot)
+{
+    if (reuseRoot && rootPid != INVALID_PAGE)
+    {
+        pageID = rootPid;
+        PIN(pageID, page);
+    }
+    else
+    {
+        NEWPAGE(pageID, page);
+    }
+    page->Init(pageID);
+    page->SetType(type);
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::BulkLoad
+//
+// Input   : entries - (key, rid) pairs sorted in ascending key order.
+//           numEntries - number of pairs in entries.
+//           fillFactor - fraction of each page to fill, in (0, 1].
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Build the tree bottom-up in one pass.  Leaves are filled
+//           left to right and linked, then each index level is built
+//           over the level below it until a single page remains.
+// Note    : Only an empty tree can be loaded.  An empty root page is
+//           reused as the top node so the file entry stays valid.  The
+//           record ids of a key that occurs more than once are written
+//           to a posting list first, so each key takes one leaf entry.
+//-------------------------------------------------------------------
+
+Status BTreeFile::BulkLoad(const LeafEntry* entries, int numEntries, float fillFactor)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
+    SortedPage *rootPage;
+    BTLeafPage *leafPage, *prevLeafPage;
+    BTIndexPage *indexPage;
+    PageID pageID, prevLeafPid;
+    RecordID outRid;
+    vector<int> leafKeys;
+    vector<RecordID> leafRids;
+    vector<int> keys, upperKeys;
+    vector<PageID> pids, upperPids;
+    bool empty;
+
+    if (fillFactor <= 0 || fillFactor > 1)
+        return FAIL;
+
+    for (int i = 1; i < numEntries; i++)
+    {
+        if (entries[i].key < entries[i - 1].key)
+            return FAIL;
+    }
+
+    ForgetLastLeaf();
+
+    if (rootPid != INVALID_PAGE)
+    {
+        PIN(rootPid, rootPage);
+        empty = (rootPage->GetType() == LEAF_NODE) && (rootPage->GetNumOfRecords() == 0);
+        UNPIN(rootPid, CLEAN);
+        if (!empty)
+            return FAIL;
+    }
+
+    if (numEntries <= 0)
+        return OK;
+
+    for (int i = 0, run; i < numEntries; i += run)
+    {
+        LeafEntry entry = entries[i];
+        for (run = 1; (i + run < numEntries) && (entries[i + run].key == entry.key); run++)
+            ;
+        if ((run > 1) && (BuildPostingList(entries + i, run, entry.rid) != OK))
+            return FAIL;
+        leafKeys.push_back(entry.key);
+        leafRids.push_back(entry.rid);
+    }
+    int numLeafEntries = leafKeys.size();
+    const int *allKeys = leafKeys.data();
+    const RecordID *allRids = leafRids.data();
+
+    // Cut the entries into leaves of the fill factor, taking more than
+    // a dense leaf holds wherever the entries are close enough to be
+    // packed.  The last two leaves are evened out so that the last one
+    // is not left nearly empty.
+    int denseCap = max(1, (int)(fillFactor * LEAF_DENSE_CAPACITY));
+    vector<int> counts;
+    for (int first = 0; first < numLeafEntries; first += counts.back())
+    {
+        int count = min(denseCap, numLeafEntries - first);
+        while ((count >= LEAF_DENSE_CAPACITY) && (count < LEAF_PACKED_CAPACITY)
+            && (first + count < numLeafEntries)
+            && (count + 1 <= (int)(fillFactor
+                    * BTLeafPage::PackedCapacity(allKeys + first, allRids + first, count + 1))))
+            count++;
+        counts.push_back(count);
+    }
+
+    int numLeaves = counts.size();
+    if ((numLeaves > 1) && (counts[numLeaves - 1] + 1 < counts[numLeaves - 2]))
+    {
+        int total = counts[numLeaves - 2] + counts[numLeaves - 1];
+        int first = numLeafEntries - total / 2;
+        if (BTLeafPage::Fits(allKeys + first, allRids + first, total / 2))
+        {
+            counts[numLeaves - 2] = total - total / 2;
+            counts[numLeaves - 1] = total / 2;
+        }
+    }
+    int next = 0;
+
+    prevLeafPid = INVALID_PAGE;
+    prevLeafPage = nullptr;
+    for (int i = 0; i < numLeaves; i++)
+    {
+        int count = counts[i];
+
+        if (NewNode(pageID, (SortedPage *&)leafPage, LEAF_NODE, numLeaves == 1) != OK)
+            return FAIL;
+        leafPage->SetPrevPage(prevLeafPid);
+
+        keys.push_back(allKeys[next]);
+        pids.push_back(pageID);
+        leafPage->WriteEntries(allKeys + next, allRids + next, count);
+        next += count;
+
+        if (prevLeafPage != nullptr)
+        {
+            prevLeafPage->SetNextPage(pageID);
+            UNPIN(prevLeafPid, DIRTY);
+        }
+        prevLeafPid = pageID;
+        prevLeafPage = leafPage;
+    }
+    UNPIN(prevLeafPid, DIRTY);
+
+    // An index page holds at least two entries so that every node
+    // above the leaves has at least three children.
+    int indexCap = (int)(fillFactor * INDEX_DENSE_CAPACITY);
+    if (indexCap < 2)
+        indexCap = 2;
+
+    while (pids.size() > 1)
+    {
+        int numChildren = pids.size();
+        int numPages = (numChildren + indexCap) / (indexCap + 1);
+        next = 0;
+
+        for (int i = 0; i < numPages; i++)
+        {
+            int count = numChildren / numPages + (i < numChildren % numPages ? 1 : 0);
+
+            if (NewNode(pageID, (SortedPage *&)indexPage, INDEX_NODE, numPages == 1) != OK)
+                return FAIL;
+            indexPage->SetLeftLink(pids[next]);
+
+            upperKeys.push_back(keys[next]);
+            upperPids.push_back(pageID);
+            for (int j = 1; j < count; j++)
+                INSERT(indexPage, keys[next + j], pids[next + j], outRid);
+            next += count;
+
+            UNPIN(pageID, DIRTY);
+        }
+
+        keys.swap(upperKeys);
+        pids.swap(upperPids);
+        upperKeys.clear();
+        upperPids.clear();
+    }
+
+    rootPid = pids[0];
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::InsertBatch
+//
+// Input   : entries - (key, rid) pairs to be inserted, in any order.
+//           numEntries - number of pairs in entries.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Insert a batch of entries with one descent per target leaf.
+// Note    : The batch is sorted first.  Every entry that falls in the
+//           key range of the located leaf is added while the leaf stays
+//           pinned.  When an entry finds no room on the leaf, room is
+//           made for it and the rest of the batch descends again.
+//-------------------------------------------------------------------
+
+Status BTreeFile::InsertBatch(const LeafEntry* entries, size_t numEntries)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
+    BTLeafPage *leafPage;
+    PageID leafPid;
+    TreePath path;
+    int slotNo;
+    bool newEntry, placed;
+
+    vector<LeafEntry> sorted(entries, entries + numEntries);
+    stable_sort(sorted.begin(), sorted.end(),
+        [](const LeafEntry& a, const LeafEntry& b) { return a.key < b.key; });
+
+    size_t next = 0;
+    while (next < numEntries)
+    {
+        // The tree is latched already, so the first entry of an empty
+        // tree goes in without latching again.
+        if (rootPid == INVALID_PAGE)
+        {
+            if (InsertEntry(sorted[next].key, sorted[next].rid, KEEP_BOTH, false) != OK)
+                return FAIL;
+            next++;
+            continue;
+        }
+
+        if (Descend<InsertOp>(sorted[next].key, path, leafPid, leafPage) != OK)
+            return FAIL;
+
+        while ((next < numEntries) && (!path.hasHigh || sorted[next].key < path.highKey))
+        {
+            if (AddToLeaf(leafPage, sorted[next].key, sorted[next].rid, KEEP_BOTH,
+                          slotNo, newEntry, placed) != OK)
+            {
+                UNPIN(leafPid, DIRTY);
+                return FAIL;
+            }
+            if (!placed)
+                break;
+            next++;
+        }
+        UNPIN(leafPid, DIRTY);
+
+        if ((next < numEntries) && (!path.hasHigh || sorted[next].key < path.highKey))
+        {
+            if (MakeRoom(leafPid, path, sorted[next].key, sorted[next].rid) != OK)
+                return FAIL;
+        }
+    }
+
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::Descend
+//
+// Input   : key - the key to locate.
+// Output  : path - the index pages walked through if Op keeps them,
+//                  and the separators around the leaf's key range.
+//           leafPid - the leaf whose key range holds key.
+//           leafPage - the leaf, pinned.  The caller unpins it.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Walk from the root down to the leaf for key.
+// Note    : Op is one of SearchOp, InsertOp or DeleteOp, so the choice
+//           of recording the path is made at compile time.  Only one
+//           page is pinned at a time.
+//
+//           A search that latches goes down optimistically instead;
+//           see DescendOptimistic.  Any other path that latches crabs
+//           down the tree: the latch of a child is taken before that
+//           of its parent is given up.  An insert or delete
+//           latches pages exclusively.  A delete gives up the pages
+//           above an index page only once it is safe, that is it loses
+//           an entry without merging, and an insert always does, as it
+//           tells the parent of a split afterwards; see SplitLinked.
+//           What the change may touch above the leaf is left latched,
+//           and the caller decides about the leaf, which it knows the
+//           change to.  The root pointer counts as the page above the
+//           root.  A page whose split is pending and whose high key
+//           key is beyond has its split finished, and the walk is
+//           started again, so that writers only reach pages through
+//           their parents.
+//-------------------------------------------------------------------
+
+template <class Op>
+Status BTreeFile::Descend(const int key, TreePath& path, PageID& leafPid, BTLeafPage*& leafPage)
+{
+    SortedPage *page;
+    BTIndexPage *indexPage;
+    PageID pageID, childPid;
+    int slot, separator;
+
+    if ((Op::Change == 0) && path.Latching())
+        return DescendOptimistic(key, path, leafPid, leafPage);
+
+    for (;;)
+    {
+        path.depth = 0;
+        path.hasLow = path.hasHigh = false;
+        path.LatchRoot();
+        pageID = rootPid;
+        path.LatchPage(pageID);
+
+        PIN(pageID, page);
+        while ((page->GetType() == INDEX_NODE) && !page->Beyond(key))
+        {
+            indexPage = (BTIndexPage *)page;
+            if (Op::KeepPath)
+            {
+                if (path.depth == MAX_TREE_DEPTH)
+                {
+                    UNPIN(pageID, CLEAN);
+                    return FAIL;
+                }
+                path.pids[path.depth++] = pageID;
+            }
+            if (path.Latching() && (Op::Change != 0)
+                && IndexSafe(indexPage, path.depth == 1, Op::Change))
+                path.UnlatchAbove();
+
+            // A key equal to a separator belongs to the right child.
+            slot = indexPage->UpperBound(key);
+            childPid = (slot == 0) ? indexPage->GetLeftLink() : indexPage->GetEntry(slot - 1).pid;
+            if (slot > 0)
+            {
+                path.lowKey = indexPage->GetEntry(slot - 1).key;
+                path.hasLow = true;
+            }
+            if (slot < indexPage->GetNumOfRecords())
+            {
+                path.highKey = indexPage->GetEntry(slot).key;
+                path.hasHigh = true;
+            }
+            else if (indexPage->SplitPending())
+            {
+                path.highKey = indexPage->GetHighKey();
+                path.hasHigh = true;
+            }
+
+            UNPIN(pageID, CLEAN);
+            pageID = childPid;
+            path.LatchPage(pageID);
+            PIN(pageID, page);
+        }
+
+        if (!page->Beyond(key))
+        {
+            leafPid = pageID;
+            leafPage = (BTLeafPage *)page;
+            return OK;
+        }
+
+        separator = page->GetHighKey();
+        UNPIN(pageID, CLEAN);
+        path.UnlatchAll();
+        if (FinishSplit(pageID, separator) != OK)
+            return FAIL;
+    }
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::DescendOptimistic
+//
+// Input   : key - the value of the key to search for.
+//           path - a path that latches in shared mode.
+// Output  : leafPid - id of the leaf whose range holds key.
+//           leafPage - the leaf, pinned and latched.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Walk down to the leaf of key without latching, or writing
+//           to, the root pointer and the index pages.
+// Note    : Each index page is copied out of the buffer pool, and the
+//           copy is only used if the versions of the page and of its
+//           parent are the same after the copy as before, so that the
+//           page was still the child for key and did not change, or
+//           get freed, while it was copied.  Leaves have no versions
+//           of their own, as a leaf is only freed once its parent has
+//           changed.  A page freed meanwhile is only retired, so it is
+//           not given to another tree before the walk's epoch ends.
+//           The leaf is latched,
+//           and the parent checked once more, as inserts and deletes
+//           change leaves in place.  A failed check starts the walk
+//           again from the root.  A page whose split is pending is left
+//           for its right sibling if key is beyond its high key, as the
+//           parent does not know of the sibling yet, and the sibling
+//           is checked against it as against a parent.  A leaf is left
+//           for its sibling with both latched.  Index pages only change
+//           as nodes split or merge, so walks are seldom started again.
+//           The path records no index pages.  A copy still takes the
+//           buffer latch for as long as it pins the page, as the buffer
+//           manager has no other way in (see BufferLatch::CopyPage);
+//           it is held for the copy only, not across a level.
+//-------------------------------------------------------------------
+
+Status BTreeFile::DescendOptimistic(const int key, TreePath& path, PageID& leafPid, BTLeafPage*& leafPage)
+{
+    Page copy;
+    BTIndexPage *indexPage = (BTIndexPage *)&copy;
+    Version *parent, *page;
+    unsigned long parentSeen, seen;
+    PageID pageID;
+    int slot;
+
+    path.depth = 0;
+    path.hasLow = path.hasHigh = false;
+    for (;;)
+    {
+        parent = &rootVersion;
+        parentSeen = parent->Read();
+        pageID = rootPid;
+
+        for (;;)
+        {
+            page = &PageVersions::Of(pageID);
+            seen = page->Read();
+            if (BufferLatch::CopyPage(pageID, copy) != OK)
+                return FAIL;
+            if (!parent->Validate(parentSeen) || !page->Validate(seen))
+                break;
+
+            if (indexPage->GetType() != INDEX_NODE)
+            {
+                path.LatchPage(pageID);
+                if (!parent->Validate(parentSeen))
+                {
+                    path.UnlatchPage(pageID);
+                    break;
+                }
+                leafPid = pageID;
+                PIN(leafPid, leafPage);
+                while (leafPage->Beyond(key))
+                {
+                    pageID = leafPage->GetNextPage();
+                    UNPIN(leafPid, CLEAN);
+                    path.LatchPage(pageID);
+                    path.UnlatchPage(leafPid);
+                    leafPid = pageID;
+                    PIN(leafPid, leafPage);
+                }
+                return OK;
+            }
+
+            // A key equal to a separator belongs to the right child,
+            // and one beyond a pending split to the right sibling.
+            parent = page;
+            parentSeen = seen;
+            if (indexPage->Beyond(key))
+                pageID = indexPage->GetRightLink();
+            else
+            {
+                slot = indexPage->UpperBound(key);
+                pageID = (slot == 0) ? indexPage->GetLeftLink() : indexPage->GetEntry(slot - 1).pid;
+            }
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::IndexSafe
+//
+// Input   : page - a pinned index page.
+//           isRoot - whether it is the root.
+//           change - +1 if a child may split, -1 if one may merge.
+// Output  : None
+// Return  : True if the page absorbs the change without splitting or
+//           merging, and the root pointer stays.
+// Purpose : Tell whether a writer can give up the pages above page.
+// Note    : A split is always safe, as the parent is only told of it
+//           once the child has been let go of; see FinishSplit.
+//-------------------------------------------------------------------
+
+bool BTreeFile::IndexSafe(BTIndexPage *page, bool isRoot, int change)
+{
+    int numRecords = page->GetNumOfRecords();
+
+    if (change > 0)
+        return true;
+    if (isRoot)
+        return (numRecords > 1);
+    return !Below(numRecords - 1, page->Capacity(), redistributeFill);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::TreePath latching
+//
+// StartLatching makes an operation latch the pages it walks in mode.
+// LatchPage and TryLatchPage take the latch of a page unless the path
+// holds it already; TryLatchPage gives up rather than wait.  Holds is
+// true of any page if the path does not latch.  UnlatchAbove gives up
+// everything but the page latched last, and UnlatchAfter everything
+// latched after pid.  A page is unlatched before it is freed, as its
+// id may be handed out again.
+//
+// Latches are taken down the tree, and left to right among pages of
+// one level.  A latch taken the other way, as that of a left sibling,
+// is only tried, so that two threads cannot wait for each other.
+//
+// WriteRoot and WritePage lock the version of the root pointer or of
+// a latched index page before a writer changes it, or moves entries
+// between or frees pages below it, for readers that do not latch
+// index pages; see DescendOptimistic.  The version is unlocked as the
+// latch is given up.
+//-------------------------------------------------------------------
+
+void BTreeFile::TreePath::StartLatching(Latch *root, Version *version, LatchMode latchMode)
+{
+    rootLatch = root;
+    rootVersion = version;
+    mode = latchMode;
+}
+
+void BTreeFile::TreePath::LatchRoot()
+{
+    if (Latching() && !rootLatched)
+    {
+        rootLatch->Acquire(mode);
+        rootLatched = true;
+    }
+}
+
+void BTreeFile::TreePath::LatchPage(PageID pid)
+{
+    if (Holds(pid))
+        return;
+    PageLatches::Acquire(pid, mode);
+    written[numLatched] = false;
+    latched[numLatched++] = pid;
+}
+
+bool BTreeFile::TreePath::TryLatchPage(PageID pid)
+{
+    if (Holds(pid))
+        return true;
+    if (!PageLatches::TryAcquire(pid, mode))
+        return false;
+    written[numLatched] = false;
+    latched[numLatched++] = pid;
+    return true;
+}
+
+bool BTreeFile::TreePath::Holds(PageID pid) const
+{
+    if (!Latching())
+        return true;
+    for (int i = 0; i < numLatched; i++)
+    {
+        if (latched[i] == pid)
+            return true;
+    }
+    return false;
+}
+
+void BTreeFile::TreePath::WriteRoot()
+{
+    if (rootLatched && !rootWritten)
+    {
+        rootVersion->Lock();
+        rootWritten = true;
+    }
+}
+
+void BTreeFile::TreePath::WritePage(PageID pid)
+{
+    for (int i = 0; i < numLatched; i++)
+    {
+        if ((latched[i] == pid) && !written[i])
         {
-            UNPIN(childPid, CLEAN);
-            UNPIN(indexPid, CLEAN);
-            status = LeafInsert(childPid, indexPid, key, rid);
+            PageVersions::Of(pid).Lock();
+            written[i] = true;
+        }
+    }
+}
+
+void BTreeFile::TreePath::ReleaseRoot()
+{
+    if (rootWritten)
+    {
+        rootVersion->Unlock();
+        rootWritten = false;
+    }
+    rootLatch->Release(mode);
+    rootLatched = false;
+}
+
+void BTreeFile::TreePath::Release(int i)
+{
+    if (written[i])
+        PageVersions::Of(latched[i]).Unlock();
+    PageLatches::Release(latched[i], mode);
+}
+
+void BTreeFile::TreePath::UnlatchPage(PageID pid)
+{
+    for (int i = 0; i < numLatched; i++)
+    {
+        if (latched[i] == pid)
+        {
+            Release(i);
+            for (numLatched--; i < numLatched; i++)
+            {
+                latched[i] = latched[i + 1];
+                written[i] = written[i + 1];
+            }
+            return;
+        }
+    }
+}
+
+void BTreeFile::TreePath::UnlatchAbove()
+{
+    if (rootLatched)
+        ReleaseRoot();
+    if (numLatched <= 1)
+        return;
+    for (int i = 0; i < numLatched - 1; i++)
+        Release(i);
+    latched[0] = latched[numLatched - 1];
+    written[0] = written[numLatched - 1];
+    numLatched = 1;
+}
+
+void BTreeFile::TreePath::UnlatchAfter(PageID pid)
+{
+    for (int i = 0; i < numLatched; i++)
+    {
+        if (latched[i] == pid)
+        {
+            for (int j = i + 1; j < numLatched; j++)
+                Release(j);
+            numLatched = i + 1;
+            return;
+        }
+    }
+}
+
+void BTreeFile::TreePath::UnlatchAll()
+{
+    if (rootLatched)
+        ReleaseRoot();
+    for (int i = 0; i < numLatched; i++)
+        Release(i);
+    numLatched = 0;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::Delete
+//
+// Input   : key - the value of the key to be deleted.
+//           rid - RecordID of the record to be deleted.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Delete an index entry with this rid and key.
+// Note    : See DeleteEntry.
+//-------------------------------------------------------------------
+
+Status
+BTreeFile::Delete(const int key, const RecordID rid)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
+    Snapshots::Writer writer(snapshots);
+    return DeleteEntry(key, rid, threadSafe);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::DeleteEntry
+//
+// Input   : key - the value of the key to be deleted.
+//           rid - RecordID of the record to be deleted.
+//           latch - latch pages on the way, in thread-safe mode.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Delete an index entry with this rid and key.
+// Note    : An underflowing leaf is merged with or borrows from a
+//           sibling, and the parents are fixed on the way back up.  A
+//           latching delete keeps the pages above the leaf unless the
+//           leaf stays filled whatever it loses.
+//-------------------------------------------------------------------
+
+Status BTreeFile::DeleteEntry(const int key, const RecordID rid, bool latch)
+{
+    BTLeafPage *leafPage;
+    PageID leafPid;
+    PostingChange change;
+    TreePath path;
+    int slotNo;
+    bool underflow;
+
+    if (latch)
+        path.StartLatching(&rootLatch, &rootVersion, LATCH_EXCLUSIVE);
+    path.LatchRoot();
+    if (rootPid == INVALID_PAGE)
+    {
+        return DONE;
+    }
+
+    if (Descend<DeleteOp>(key, path, leafPid, leafPage) != OK)
+        return FAIL;
+
+    if (path.Latching() && ((path.depth == 0)
+        || !Below(leafPage->GetNumOfRecords() - 1, leafPage->FillCapacity(), redistributeFill)))
+        path.UnlatchAbove();
+
+    if (RemoveFromLeaf(leafPage, key, rid, false, slotNo, change) != OK)
+    {
+        UNPIN(leafPid, CLEAN);
+        return FAIL;
+    }
+    underflow = Below(leafPage->GetNumOfRecords(), leafPage->FillCapacity(), redistributeFill);
+    UNPIN(leafPid, DIRTY);
+
+    // A leaf root has no sibling and stays even when empty, as the one
+    // created with the file does.  A leaf that lost more of its
+    // capacity than foreseen, and let go of its parent, is left as is.
+    if (underflow && (path.depth > 0) && path.Holds(path.Parent()))
+        return ReDistributeMerge(leafPid, path);
+
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::RemoveFromLeaf
+//
+// Input   : leafPage - the pinned leaf whose range holds key.
+//           key - the value of the key to be deleted.
+//           rid - RecordID of the record to be deleted.
+//           keepFilled - refuse to take an entry off the leaf if that
+//                        leaves it to be rebalanced.
+// Output  : slotNo - the position of the entry of key on the leaf.
+//           change - where rid was taken from if key has a posting
+//                    list, otherwise change.pid is INVALID_PAGE and the
+//                    entry is gone.
+// Return  : OK if successful, DONE if refused, FAIL if there is no
+//           such entry.  Nothing is changed unless OK is returned.
+// Purpose : Take rid off key on the leaf, which is left pinned.
+//-------------------------------------------------------------------
+
+Status BTreeFile::RemoveFromLeaf(BTLeafPage *leafPage, const int key, const RecordID rid,
+                                 bool keepFilled, int& slotNo, PostingChange& change)
+{
+    RecordID outRid;
+
+    slotNo = leafPage->LowerBound(key);
+    change.pid = INVALID_PAGE;
+    change.freed = change.collapsed = change.moved = false;
+    if ((slotNo < leafPage->GetNumOfRecords()) && (leafPage->GetKey(slotNo) == key)
+        && IsPostingList(leafPage->GetEntry(slotNo).rid))
+        return RemoveFromPostingList(leafPage, slotNo, rid, keepFilled, change);
+
+    if (keepFilled && Below(leafPage->GetNumOfRecords() - 1, leafPage->FillCapacity(), redistributeFill))
+        return DONE;
+
+    if (leafPage->Delete(key, rid, outRid) != OK)
+        return FAIL;
+    slotNo = outRid.slotNo;
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::Delete
+//
+// Input   : key - the value of the key to be deleted.
+//           rid - RecordID of the record to be deleted.
+//           hint - an open scan of this index, positioned near key.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Delete an index entry, starting from the leaf the scan
+//           is on.
+// Note    : Finding the entry on the leaf is proof enough that it is
+//           the right one.  If the entry is elsewhere, or the leaf
+//           would underflow, the delete descends from the root and
+//           the scan is positioned again, as the leaf may be gone.
+//           So is a scan on a posting list that shrinks to one record
+//           id, since that id moves into the leaf entry, or whose
+//           record ids move to another page.  A snapshot scan is no
+//           hint.
+//-------------------------------------------------------------------
+
+Status
+BTreeFile::Delete(const int key, const RecordID rid, IndexFileScan* hint)
+{
+    BTreeFileScan *scan = (BTreeFileScan *)hint;
+    BTLeafPage *leafPage;
+    PostingChange change;
+    Status status = FAIL;
+    int slotNo;
+
+    if ((scan == nullptr) || (scan->btf != this) || (scan->snapshot != nullptr))
+        return Delete(key, rid);
+
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
+    if (scan->scanPid != INVALID_PAGE)
+    {
+        PIN(scan->scanPid, leafPage);
+        if (leafPage->GetType() == LEAF_NODE)
+            status = RemoveFromLeaf(leafPage, key, rid, scan->scanPid != rootPid, slotNo, change);
+        UNPIN(scan->scanPid, (status == OK) ? DIRTY : CLEAN);
+
+        if ((status == OK) && !change.collapsed && !change.moved)
+        {
+            if (change.pid == INVALID_PAGE)
+                scan->EntryDeleted(slotNo);
+            else
+                scan->RidDeleted(slotNo, change);
+            scan->RememberPages();
+            return OK;
+        }
+    }
+
+    if (status != OK)
+    {
+        status = DeleteEntry(key, rid, false);
+        if (status != OK)
             return status;
+    }
+
+    if ((scan->flag == "processing") && (key == scan->currentKey)
+        && (rid == scan->currentRid))
+        scan->setFlag("delete");
+    return RepositionScan(scan);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::RepositionScan
+//
+// Input   : scan - an open scan of this index.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Find the scan's place again after the tree has changed
+//           shape under it.
+// Note    : A scan that has not started yet goes back to its low key.
+//           Otherwise it goes to the entry it returned last, or to
+//           the one after it if that entry has been deleted.  Found
+//           on the one after, the scan returns that one next.
+//-------------------------------------------------------------------
+
+Status BTreeFile::RepositionScan(BTreeFileScan* scan)
+{
+    bool onCurrent;
+
+    if (scan->flag == "start")
+        return PositionScan(scan, scan->lowKey, nullptr, onCurrent);
+
+    if (PositionScan(scan, &scan->currentKey, &scan->currentRid, onCurrent) != OK)
+        return FAIL;
+    if ((scan->flag == "processing") && !onCurrent)
+        scan->setFlag("delete");
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::AddToPostingList
+//
+// Input   : leafPage - a pinned leaf.
+//           slotNo - the position of an entry on the leaf.
+//           rid - the record id to add to the entry.
+// Output  : placed - false if the leaf has no room for the record id
+//                    of a new posting list, in which case nothing was
+//                    changed.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Add rid to the record ids of an entry.  An entry with a
+//           single record id is given a posting list first.
+// Note    : rid goes to the last page if it is not less than the first
+//           record id there, which is the case when records are added
+//           in order.  Otherwise the list is walked from its first
+//           page.  A full page is split in half, except that a record
+//           id past the end of the list starts a new last page alone.
+//-------------------------------------------------------------------
+
+Status BTreeFile::AddToPostingList(BTLeafPage *leafPage, int slotNo, const RecordID rid,
+                                   bool& placed)
+{
+    BTPostingPage *headPage, *page, *newPage, *nextPage;
+    PageID headPid, lastPid, pid, newPid, nextPid;
+    RecordID dataRid = leafPage->GetEntry(slotNo).rid;
+    RecordID listRid;
+
+    if (!IsPostingList(dataRid))
+    {
+        if (NewNode(pid, (SortedPage *&)page, POSTING_NODE, false) != OK)
+            return FAIL;
+
+        listRid.pageNo = pid;
+        listRid.slotNo = POSTING_LIST_SLOT;
+        if (!leafPage->CanSetDataRid(slotNo, listRid))
+        {
+            UNPIN(pid, CLEAN);
+            FREEPAGE(pid);
+            placed = false;
+            return OK;
         }
-        if(flag == "search")
+
+        page->SetPrevPage(pid);
+        page->Insert(dataRid);
+        page->Insert(rid);
+        UNPIN(pid, DIRTY);
+        return leafPage->SetDataRid(slotNo, listRid);
+    }
+
+    // The first page stays pinned, as it records the last one.
+    headPid = dataRid.pageNo;
+    PIN(headPid, headPage);
+    lastPid = pid = headPage->GetPrevPage();
+    PIN(pid, page);
+    if (rid < page->GetRid(0))
+    {
+        UNPIN(pid, CLEAN);
+        pid = headPid;
+        PIN(pid, page);
+        while ((page->GetLastRid() < rid) && (page->GetNextPage() != lastPid))
         {
-            path.push(childPid);
-            outPid = childPid;
-            UNPIN(childPid, CLEAN);
-            UNPIN(indexPid, CLEAN);
+            nextPid = page->GetNextPage();
+            UNPIN(pid, CLEAN);
+            pid = nextPid;
+            PIN(pid, page);
+        }
+    }
+
+    if (page->IsFull())
+    {
+        if (NewNode(newPid, (SortedPage *&)newPage, POSTING_NODE, false) != OK)
+            return FAIL;
+        if ((pid != lastPid) || !(page->GetLastRid() < rid))
+            page->MoveUpperHalfTo(*newPage);
+
+        nextPid = page->GetNextPage();
+        newPage->SetNextPage(nextPid);
+        newPage->SetPrevPage(pid);
+        page->SetNextPage(newPid);
+        if (nextPid == INVALID_PAGE)
+        {
+            headPage->SetPrevPage(newPid);
+        }
+        else
+        {
+            PIN(nextPid, nextPage);
+            nextPage->SetPrevPage(newPid);
+            UNPIN(nextPid, DIRTY);
+        }
+
+        if ((newPage->GetNumOfRecords() == 0) || !(rid < newPage->GetRid(0)))
+        {
+            UNPIN(pid, DIRTY);
+            pid = newPid;
+            page = newPage;
+        }
+        else
+        {
+            UNPIN(newPid, DIRTY);
+        }
+    }
+
+    page->Insert(rid);
+    UNPIN(pid, DIRTY);
+    UNPIN(headPid, DIRTY);
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::RemoveFromPostingList
+//
+// Input   : leafPage - a pinned leaf.
+//           slotNo - the position of an entry with a posting list.
+//           rid - the record id to remove from the entry.
+//           keepFilled - refuse to take the entry off the leaf, with
+//                        its last record id, if that leaves the leaf to
+//                        be rebalanced.
+// Output  : change - where rid was taken from.
+// Return  : OK if successful, DONE if refused, FAIL if rid is not in
+//           the list.
+// Purpose : Remove rid from the posting list of an entry.
+// Note    : The leaf entry keeps pointing at the first page, so that
+//           its record id stays the same size.  A page left empty is
+//           unlinked and freed, except the first page, which takes
+//           over the record ids of the second instead.  When a single
+//           record id is left, it moves back into the leaf entry if
+//           the leaf has room for it.  A list that cannot be collapsed
+//           this way takes the entry with it when it is emptied.
+//-------------------------------------------------------------------
+
+Status BTreeFile::RemoveFromPostingList(BTLeafPage *leafPage, int slotNo, const RecordID rid,
+                                        bool keepFilled, PostingChange& change)
+{
+    BTPostingPage *headPage, *page, *linkPage;
+    PageID headPid, pid, prevPid, nextPid;
+    LeafEntry entry = leafPage->GetEntry(slotNo);
+    RecordID outRid;
+
+    headPid = entry.rid.pageNo;
+    PIN(headPid, headPage);
+    pid = headPid;
+    PIN(pid, page);
+    while ((page->GetLastRid() < rid) && (page->GetNextPage() != INVALID_PAGE))
+    {
+        nextPid = page->GetNextPage();
+        UNPIN(pid, CLEAN);
+        pid = nextPid;
+        PIN(pid, page);
+    }
+
+    if ((page->GetNumOfRecords() == 1) && (page->GetRid(0) == rid)
+        && (pid == headPid) && (page->GetNextPage() == INVALID_PAGE))
+    {
+        UNPIN(pid, CLEAN);
+        UNPIN(headPid, CLEAN);
+        if (keepFilled && Below(leafPage->GetNumOfRecords() - 1, leafPage->FillCapacity(), redistributeFill))
+            return DONE;
+
+        FREEPAGE(headPid);
+        change.moved = true;
+        return leafPage->Delete(entry.key, entry.rid, outRid);
+    }
+
+    if (page->Delete(rid, change.slotNo) != OK)
+    {
+        UNPIN(pid, CLEAN);
+        UNPIN(headPid, CLEAN);
+        return FAIL;
+    }
+    change.pid = pid;
+    change.nextPid = nextPid = page->GetNextPage();
+
+    if (page->GetNumOfRecords() > 0)
+    {
+        UNPIN(pid, DIRTY);
+        UNPIN(headPid, DIRTY);
+        return CollapsePostingList(leafPage, slotNo, change);
+    }
+
+    if (pid == headPid)
+    {
+        // The second page moves into the first, which the last page
+        // link stays on.
+        PIN(nextPid, linkPage);
+        for (int i = 0; i < linkPage->GetNumOfRecords(); i++)
+            page->Insert(linkPage->GetRid(i));
+        prevPid = nextPid;
+        nextPid = linkPage->GetNextPage();
+        UNPIN(prevPid, CLEAN);
+        FREEPAGE(prevPid);
+
+        page->SetNextPage(nextPid);
+        if (nextPid == INVALID_PAGE)
+        {
+            page->SetPrevPage(headPid);
+        }
+        else
+        {
+            PIN(nextPid, linkPage);
+            linkPage->SetPrevPage(headPid);
+            UNPIN(nextPid, DIRTY);
+        }
+
+        UNPIN(pid, DIRTY);
+        UNPIN(headPid, DIRTY);
+        change.moved = true;
+        return CollapsePostingList(leafPage, slotNo, change);
+    }
+
+    prevPid = page->GetPrevPage();
+    PIN(prevPid, linkPage);
+    linkPage->SetNextPage(nextPid);
+    UNPIN(prevPid, DIRTY);
+    if (nextPid == INVALID_PAGE)
+    {
+        headPage->SetPrevPage(prevPid);
+    }
+    else
+    {
+        PIN(nextPid, linkPage);
+        linkPage->SetPrevPage(prevPid);
+        UNPIN(nextPid, DIRTY);
+    }
+
+    UNPIN(pid, DIRTY);
+    UNPIN(headPid, DIRTY);
+    FREEPAGE(pid);
+    change.freed = true;
+    return CollapsePostingList(leafPage, slotNo, change);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::CollapsePostingList
+//
+// Input   : leafPage - a pinned leaf.
+//           slotNo - the position of an entry with a posting list.
+// Output  : change - collapsed is set if the list was freed.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Move the record id of a list that holds only one back
+//           into the leaf entry, and free the list.
+// Note    : The list is kept if the leaf has no room for the record
+//           id inline.
+//-------------------------------------------------------------------
+
+Status BTreeFile::CollapsePostingList(BTLeafPage *leafPage, int slotNo, PostingChange& change)
+{
+    BTPostingPage *page;
+    RecordID dataRid = leafPage->GetEntry(slotNo).rid;
+    PageID pid = dataRid.pageNo;
+
+    PIN(pid, page);
+    if ((page->GetNextPage() != INVALID_PAGE) || (page->GetNumOfRecords() > 1)
+        || !leafPage->CanSetDataRid(slotNo, page->GetRid(0)))
+    {
+        UNPIN(pid, CLEAN);
+        return OK;
+    }
+
+    dataRid = page->GetRid(0);
+    UNPIN(pid, CLEAN);
+    FREEPAGE(pid);
+    change.collapsed = true;
+    return leafPage->SetDataRid(slotNo, dataRid);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::FindInPostingList
+//
+// Input   : dataRid - the record id of an entry with a posting list.
+//           rid - the record id to look for.
+// Output  : pid, slotNo - where the first record id not less than rid
+//                         is, pid is INVALID_PAGE if there is none.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Find a place in a posting list.
+//-------------------------------------------------------------------
+
+Status BTreeFile::FindInPostingList(const RecordID dataRid, const RecordID rid,
+                                    PageID& pid, int& slotNo)
+{
+    BTPostingPage *page;
+    PageID nextPid;
+
+    for (pid = dataRid.pageNo; pid != INVALID_PAGE; pid = nextPid)
+    {
+        PIN(pid, page);
+        if (!(page->GetLastRid() < rid))
+        {
+            slotNo = page->Find(rid);
+            UNPIN(pid, CLEAN);
             return OK;
         }
-        if(flag == "delete")
+        nextPid = page->GetNextPage();
+        UNPIN(pid, CLEAN);
+    }
+
+    slotNo = 0;
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::BuildPostingList
+//
+// Input   : entries - entries that all have the same key.
+//           numEntries - number of entries, at least two.
+// Output  : dataRid - the record id for the leaf entry of the key.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Write the record ids of the entries to a new posting list,
+//           filling every page.
+//-------------------------------------------------------------------
+
+Status BTreeFile::BuildPostingList(const LeafEntry* entries, int numEntries, RecordID& dataRid)
+{
+    BTPostingPage *page, *prevPage;
+    PageID pid, prevPid = INVALID_PAGE;
+    vector<RecordID> rids;
+
+    for (int i = 0; i < numEntries; i++)
+        rids.push_back(entries[i].rid);
+    sort(rids.begin(), rids.end());
+
+    dataRid.slotNo = POSTING_LIST_SLOT;
+    for (int i = 0; i < numEntries; i += POSTING_CAPACITY)
+    {
+        if (NewNode(pid, (SortedPage *&)page, POSTING_NODE, false) != OK)
+            return FAIL;
+        for (int j = i; (j < numEntries) && (j < i + POSTING_CAPACITY); j++)
+            page->Insert(rids[j]);
+
+        if (prevPid == INVALID_PAGE)
+        {
+            dataRid.pageNo = pid;
+        }
+        else
         {
-            childLeafPage = (BTLeafPage *)childPage;
+            page->SetPrevPage(prevPid);
+            PIN(prevPid, prevPage);
+            prevPage->SetNextPage(pid);
+            UNPIN(prevPid, DIRTY);
+        }
+        UNPIN(pid, DIRTY);
+        prevPid = pid;
+    }
+
+    PIN(dataRid.pageNo, page);
+    page->SetPrevPage(prevPid);
+    UNPIN(dataRid.pageNo, DIRTY);
+    return OK;
+}
 
-            childLeafPage->Delete(key, rid, outRid);
+//-------------------------------------------------------------------
+// BTreeFile::FreePostingList
+//
+// Input   : dataRid - the record id of an entry with a posting list.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Free every page of the posting list.
+//-------------------------------------------------------------------
 
-            UNPIN(childPid,DIRTY);
-            if(childLeafPage-> AvailableSpace () > HEAPPAGE_DATA_SIZE / 2)
-            {
-                status = ReDistributeMerge(childPid);
-            }
+Status BTreeFile::FreePostingList(const RecordID dataRid)
+{
+    BTPostingPage *page;
+    PageID pid, nextPid;
 
-        }
+    for (pid = dataRid.pageNo; pid != INVALID_PAGE; pid = nextPid)
+    {
+        PIN(pid, page);
+        nextPid = page->GetNextPage();
+        UNPIN(pid, CLEAN);
+        FREEPAGE(pid);
     }
-    else
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::VisitRids
+//
+// Input   : dataRid - the record id of a leaf entry.
+//           visit - called with each record id of the entry in order,
+//                   returns false to stop.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Go through the record ids of an entry: its own, or those
+//           of its posting list.
+//-------------------------------------------------------------------
+
+template <class Visit>
+Status BTreeFile::VisitRids(const RecordID dataRid, Visit visit)
+{
+    BTPostingPage *page;
+    PageID pid, nextPid;
+    bool more = true;
+
+    if (!IsPostingList(dataRid))
     {
-        UNPIN(childPid,CLEAN);
-        status = IndexSearch(childPid, key, rid, outPid, flag);
+        visit(dataRid);
+        return OK;
+    }
+
+    for (pid = dataRid.pageNo; more && (pid != INVALID_PAGE); pid = nextPid)
+    {
+        PIN(pid, page);
+        for (int i = 0; more && (i < page->GetNumOfRecords()); i++)
+            more = visit(page->GetRid(i));
+        nextPid = page->GetNextPage();
+        UNPIN(pid, CLEAN);
     }
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::DeleteRange
+//
+// Input   : lowKey, highKey - pointer to keys, indicate the range
+//                             to delete (same usage as in OpenScan).
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Delete every entry whose key lies in the range.
+// Note    : Subtrees that fall wholly inside the range are freed
+//           without being searched.  Only the two boundary leaves are
+//           trimmed, and each index page on the two boundary paths is
+//           rewritten once.
+//-------------------------------------------------------------------
+
+Status BTreeFile::DeleteRange(const int* lowKey, const int* highKey)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    Snapshots::Writer writer(snapshots);
+    SortedPage *rootPage;
+    PageID oldRootPid;
+    int remaining;
+
+    if (rootPid == INVALID_PAGE)
+        return OK;
+    if ((lowKey != nullptr) && (highKey != nullptr) && (*lowKey > *highKey))
+        return OK;
+
+    ForgetLastLeaf();
+    if (RelinkLeavesAround(lowKey, highKey) != OK)
+        return FAIL;
 
-    bool right = false;
+    if (DeleteRangeNode(rootPid, lowKey, highKey, nullptr, nullptr, remaining) != OK)
+        return FAIL;
 
-    if(flag == "delete")
+    if (remaining == 0)
     {
-        if(!indexpage->IsAtLeastHalfFull()&&(indexPid!=rootPid))
-        {
-            path.pop();
-            PageID siblingIndexID = getSibilingIndex(indexPid, path.top(), right);
-            IndexReDistributeMerge(indexPid, indexpage, siblingIndexID, right);
-            UNPIN(indexPid, DIRTY);
+        FREEPAGE(rootPid);
+        rootPid = INVALID_PAGE;
+        return OK;
+    }
 
-        }
-        else
+    // An index root left with a single child is replaced by that child.
+    PIN(rootPid, rootPage);
+    while ((rootPage->GetType() == INDEX_NODE) && (rootPage->GetNumOfRecords() == 0))
+    {
+        oldRootPid = rootPid;
+        rootPid = ((BTIndexPage *)rootPage)->GetLeftLink();
+        UNPIN(oldRootPid, CLEAN);
+        FREEPAGE(oldRootPid);
+        PIN(rootPid, rootPage);
+    }
+    UNPIN(rootPid, CLEAN);
+
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::RelinkLeavesAround
+//
+// Input   : lowKey, highKey - the range about to be deleted.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Link the last leaf that keeps entries below the range to
+//           the first leaf that keeps entries above it, so that leaves
+//           freed by a range delete drop out of the leaf chain.
+//-------------------------------------------------------------------
+
+Status BTreeFile::RelinkLeavesAround(const int* lowKey, const int* highKey)
+{
+    BTLeafPage *leafPage;
+    PageID leftPid, rightPid, prevPid, nextPid;
+    RecordID dataRid, outRid;
+    TreePath path;
+    int key;
+    bool leftKept, rightKept;
+
+    if (Descend<SearchOp>((lowKey == nullptr) ? INT_MIN : *lowKey, path, leftPid, leafPage) != OK)
+        return FAIL;
+    leftKept = (lowKey != nullptr) && (leafPage->GetFirst(key, dataRid, outRid) == OK)
+        && (key < *lowKey);
+    prevPid = leafPage->GetPrevPage();
+    UNPIN(leftPid, CLEAN);
+
+    if (Descend<SearchOp>((highKey == nullptr) ? INT_MAX : *highKey, path, rightPid, leafPage) != OK)
+        return FAIL;
+    rightKept = (highKey != nullptr) && (leafPage->GetLast(key, dataRid, outRid) == OK)
+        && (key > *highKey);
+    nextPid = leafPage->GetNextPage();
+    UNPIN(rightPid, CLEAN);
+
+    if ((leftPid == rightPid) && (leftKept || rightKept))
+        return OK;
+
+    if (leftKept)
+        prevPid = leftPid;
+    if (rightKept)
+        nextPid = rightPid;
+
+    if (prevPid != INVALID_PAGE)
+    {
+        PIN(prevPid, leafPage);
+        leafPage->SetNextPage(nextPid);
+        UNPIN(prevPid, DIRTY);
+    }
+    if (nextPid != INVALID_PAGE)
+    {
+        PIN(nextPid, leafPage);
+        leafPage->SetPrevPage(prevPid);
+        UNPIN(nextPid, DIRTY);
+    }
+
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::DeleteRangeNode
+//
+// Input   : pageID - root of the subtree to delete from.
+//           lowKey, highKey - the range to delete, nullptr if open.
+//           lowBound, highBound - key range covered by this subtree,
+//                                 taken from the separators above it.
+// Output  : remaining - entries left in a leaf, or children left in
+//                       an index page.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Recursively delete the range from a subtree.
+// Note    : Emptied children are freed here; the caller frees this
+//           page if nothing remains.  An index child left with a
+//           single child is fixed against its siblings.
+//-------------------------------------------------------------------
+
+Status BTreeFile::DeleteRangeNode(PageID pageID, const int* lowKey, const int* highKey,
+                                  const int* lowBound, const int* highBound, int& remaining)
+{
+    SortedPage *page, *childPage;
+    BTLeafPage *leafPage;
+    BTIndexPage *indexPage;
+    RecordID dataRid, curRid, outRid;
+    vector<int> keys, keptKeys;
+    vector<PageID> pids, keptPids;
+    int key, childRemaining;
+    bool underflow = false;
+
+    PIN(pageID, page);
+
+    if (page->GetType() == LEAF_NODE)
+    {
+        leafPage = (BTLeafPage *)page;
+        curRid.pageNo = pageID;
+
+        // Walk backwards so that deleting a slot does not move the
+        // slots still to be visited.
+        for (curRid.slotNo = leafPage->GetNumOfRecords() - 1; curRid.slotNo >= 0; curRid.slotNo--)
         {
-            if((indexpage->GetNumOfRecords()==0)&&(indexPid==rootPid))
+            leafPage->GetCurrent(key, dataRid, curRid);
+            if (((lowKey == nullptr) || (key >= *lowKey)) && ((highKey == nullptr) || (key <= *highKey)))
             {
-                rootPid = indexpage->GetLeftLink();
+                if (IsPostingList(dataRid) && (FreePostingList(dataRid) != OK))
+                    return FAIL;
+                if (leafPage->Delete(key, dataRid, outRid) != OK)
+                    return FAIL;
             }
+        }
+
+        remaining = leafPage->GetNumOfRecords();
+        UNPIN(pageID, DIRTY);
+        return OK;
+    }
+
+    indexPage = (BTIndexPage *)page;
+    ReadIndexNode(indexPage, keys, pids);
+
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        const int *childLow = (i == 0) ? lowBound : &keys[i];
+        const int *childHigh = (i + 1 < pids.size()) ? &keys[i + 1] : highBound;
+
+        bool below = (lowKey != nullptr) && (childHigh != nullptr) && (*childHigh <= *lowKey);
+        bool above = (highKey != nullptr) && (childLow != nullptr) && (*childLow > *highKey);
+        bool inside = ((lowKey == nullptr) || ((childLow != nullptr) && (*childLow >= *lowKey)))
+            && ((highKey == nullptr) || ((childHigh != nullptr) && (*childHigh <= *highKey)));
+
+        if (below || above)
+        {
+            keptKeys.push_back(keys[i]);
+            keptPids.push_back(pids[i]);
+            continue;
+        }
+
+        if (inside)
+        {
+            if (DestroyAll(pids[i]) != OK)
+                return FAIL;
+            continue;
+        }
 
-            path.pop();
+        if (DeleteRangeNode(pids[i], lowKey, highKey, childLow, childHigh, childRemaining) != OK)
+            return FAIL;
 
-            UNPIN(indexPid, CLEAN);
+        if (childRemaining == 0)
+        {
+            FREEPAGE(pids[i]);
+            continue;
+        }
+
+        if (childRemaining == 1)
+        {
+            PIN(pids[i], childPage);
+            underflow |= (childPage->GetType() == INDEX_NODE);
+            UNPIN(pids[i], CLEAN);
         }
+
+        keptKeys.push_back(keys[i]);
+        keptPids.push_back(pids[i]);
+    }
+
+    remaining = keptPids.size();
+    if (remaining > 0)
+        WriteIndexNode(indexPage, keptKeys, keptPids);
+    UNPIN(pageID, DIRTY);
+
+    if (underflow && (remaining > 1))
+    {
+        if (FixIndexChildren(pageID) != OK)
+            return FAIL;
+
+        PIN(pageID, page);
+        remaining = page->GetNumOfRecords() + 1;
+        UNPIN(pageID, CLEAN);
     }
-    else
-        UNPIN(indexPid, CLEAN);
 
     return OK;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::getSibilingIndex
+// BTreeFile::FixIndexUnderflow
 //
-// Input   : childPid - the pid ask for redistribute
-//           parentPid - the parent pid of page who asks for redistribute
-// Output  : right - the position of siblingPage, right is true, left is false
-// Return  : PageID - the PageID of the siblingPage
-// Purpose : Find the sibling index page by the parent
+// Input   : parentPid - the parent of the index page to fix.
+//           childPid - index page that may have been left with no
+//                      entries, i.e. a single child.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Merge the child into an adjacent sibling if the sibling
+//           has room, otherwise borrow one child from the sibling.
+// Note    : The page that takes the moved grandchild is checked for
+//           children without entries afterwards.
 //-------------------------------------------------------------------
 
-PageID BTreeFile::getSibilingIndex(PageID childPid, PageID parentPid, bool &right)
+Status BTreeFile::FixIndexUnderflow(PageID parentPid, PageID childPid)
 {
-    int firstKey, nextKey, lastKey;
-    PageID firstPid, nextPid, lastPid, prevPid;
-    RecordID firstRid, nextRid, lastRid;
-    Status status = OK;
-    bool find = false;
+    BTIndexPage *parentPage, *childPage, *siblingPage;
+    vector<int> keys, childKeys, siblingKeys;
+    vector<PageID> pids, childPids, siblingPids;
+    PageID siblingPid, movedPid, newParentPid;
+    bool right;
+    size_t pos;
+    int sepKey;
+
+    PIN(parentPid, parentPage);
+    ReadIndexNode(parentPage, keys, pids);
+    pos = find(pids.begin(), pids.end(), childPid) - pids.begin();
+    if ((pos == pids.size()) || (pids.size() < 2))
+    {
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
 
-    BTIndexPage *parentPage;
-    PIN(parentPid, (Page *&)parentPage);
-    parentPage -> GetFirst(firstKey,  firstPid, firstRid);
-    // if(childPid == parentPage->GetLeftLink())
-    //     return firstPid;
-    if(childPid == firstPid)
+    PIN(childPid, childPage);
+    if (childPage->GetNumOfRecords() > 0)
     {
-        status = parentPage->GetNext(nextKey, nextPid, firstRid);
-        if(status==OK)
+        UNPIN(childPid, CLEAN);
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    movedPid = childPage->GetLeftLink();
+
+    // Prefer the right sibling; sepKey separates child and sibling.
+    right = (pos + 1 < pids.size());
+    siblingPid = right ? pids[pos + 1] : pids[pos - 1];
+    sepKey = right ? keys[pos + 1] : keys[pos];
+
+    PIN(siblingPid, siblingPage);
+    ReadIndexNode(siblingPage, siblingKeys, siblingPids);
+
+    if (!siblingPage->IsFull())
+    {
+        if (right)
         {
-            right = true;
-            return nextPid;
+            siblingKeys.insert(siblingKeys.begin(), 0);
+            siblingKeys[1] = sepKey;
+            siblingPids.insert(siblingPids.begin(), movedPid);
+            pids[pos] = siblingPid;
+            keys.erase(keys.begin() + pos + 1);
+            pids.erase(pids.begin() + pos + 1);
         }
         else
         {
-            right = false;
-            return parentPage->GetLeftLink();
+            siblingKeys.push_back(sepKey);
+            siblingPids.push_back(movedPid);
+            keys.erase(keys.begin() + pos);
+            pids.erase(pids.begin() + pos);
         }
+        WriteIndexNode(siblingPage, siblingKeys, siblingPids);
+        WriteIndexNode(parentPage, keys, pids);
+        newParentPid = siblingPid;
+
+        UNPIN(childPid, CLEAN);
+        FREEPAGE(childPid);
+        COUNT(counters.indexMerges);
     }
     else
     {
-        while (status !=DONE)
+        childKeys.push_back(0);
+        childKeys.push_back(sepKey);
+        if (right)
+        {
+            childPids.push_back(movedPid);
+            childPids.push_back(siblingPids.front());
+            keys[pos + 1] = siblingKeys[1];
+            siblingKeys.erase(siblingKeys.begin());
+            siblingPids.erase(siblingPids.begin());
+        }
+        else
         {
+            childPids.push_back(siblingPids.back());
+            childPids.push_back(movedPid);
+            keys[pos] = siblingKeys.back();
+            siblingKeys.pop_back();
+            siblingPids.pop_back();
+        }
+        WriteIndexNode(childPage, childKeys, childPids);
+        WriteIndexNode(siblingPage, siblingKeys, siblingPids);
+        WriteIndexNode(parentPage, keys, pids);
+        newParentPid = childPid;
 
-            prevPid = nextPid;
-            status = parentPage->GetNext(nextKey, nextPid, firstRid);
+        UNPIN(childPid, DIRTY);
+        COUNT(counters.indexRedistributions);
+    }
+    UNPIN(siblingPid, DIRTY);
+    UNPIN(parentPid, DIRTY);
 
-            if(childPid == nextPid)
-            {
-                status = parentPage->GetNext(nextKey, nextPid, firstRid);
-                if(status==OK)
-                {
-                    right = true;
-                    return nextPid;
-                }
-                else
-                {
-                    right = false;
-                    return prevPid;
-                }
-            }
+    return FixIndexChildren(newParentPid);
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::FixIndexChildren
+//
+// Input   : parentPid - the index page whose children to check.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Fix every child index page of parentPid that has no
+//           entries, as long as parentPid has a sibling for it.
+// Note    : A page that had a single child could not fix that child,
+//           so after it gains children its old child is fixed here.
+//-------------------------------------------------------------------
+
+Status BTreeFile::FixIndexChildren(PageID parentPid)
+{
+    BTIndexPage *parentPage;
+    SortedPage *childPage;
+    vector<int> keys;
+    vector<PageID> pids;
+    PageID underflowPid;
+
+    while (true)
+    {
+        PIN(parentPid, parentPage);
+        ReadIndexNode(parentPage, keys, pids);
+        UNPIN(parentPid, CLEAN);
+        if (pids.size() < 2)
+            return OK;
+
+        underflowPid = INVALID_PAGE;
+        for (size_t i = 0; (i < pids.size()) && (underflowPid == INVALID_PAGE); i++)
+        {
+            PIN(pids[i], childPage);
+            if ((childPage->GetType() == INDEX_NODE) && (childPage->GetNumOfRecords() == 0))
+                underflowPid = pids[i];
+            UNPIN(pids[i], CLEAN);
         }
+        if (underflowPid == INVALID_PAGE)
+            return OK;
+
+        if (FixIndexUnderflow(parentPid, underflowPid) != OK)
+            return FAIL;
     }
-    right = true;
-    return firstPid;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::Delete
+// BTreeFile::ReadIndexNode
 //
-// Input   : key - the value of the key to be deleted.
-//           rid - RecordID of the record to be deleted.
+// Input   : page - the index page to read.
+// Output  : keys, pids - the children of the page in order.  pids[0]
+//                        is the left link and keys[0] is unused.
+// Return  : OK
+// Purpose : Copy the content of an index page into two arrays.
+//-------------------------------------------------------------------
+
+Status BTreeFile::ReadIndexNode(BTIndexPage *page, vector<int>& keys, vector<PageID>& pids)
+{
+    RecordID curRid;
+    PageID pid;
+    int key;
+
+    keys.assign(1, 0);
+    pids.assign(1, page->GetLeftLink());
+
+    Status s = page->GetFirst(key, pid, curRid);
+    while (s == OK)
+    {
+        keys.push_back(key);
+        pids.push_back(pid);
+        s = page->GetNext(key, pid, curRid);
+    }
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::WriteIndexNode
+//
+// Input   : page - the index page to overwrite.
+//           keys, pids - the children in the form of ReadIndexNode.
 // Output  : None
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Delete an index entry with this rid and key.
-// Note    : If the root becomes empty, delete it.
+// Purpose : Replace the content of an index page.  A pending split
+//           of the page stays pending.
 //-------------------------------------------------------------------
 
-Status
-BTreeFile::Delete(const int key, const RecordID rid)
+Status BTreeFile::WriteIndexNode(BTIndexPage *page, const vector<int>& keys, const vector<PageID>& pids)
 {
-    // TODO: add your code here
-    Status status;
-    SortedPage * rootPage ;
-    BTLeafPage * leafpage ;
-    BTIndexPage * indexpage;
     RecordID outRid;
-    PageID leafPid, indexPid, outPid;
-    clearPath();
+    PageID nextPid = page->GetNextPage();
+    bool pending = page->SplitPending();
+    int highKey = page->GetHighKey();
+
+    page->Init(page->PageNo());
+    page->SetType(INDEX_NODE);
+    page->SetNextPage(nextPid);
+    if (pending)
+        page->SetSplitPending(highKey);
+    page->SetLeftLink(pids[0]);
+    for (size_t i = 1; i < pids.size(); i++)
+        INSERT(page, keys[i], pids[i], outRid);
 
-    short type;
-    if (rootPid == INVALID_PAGE)
+    return OK;
+}
+
+//-------------------------------------------------------------------
+// BTreeFile::ReDistributeMerge
+//
+// Input   : childPid - leaf page id requires ReDistribute and merge
+//           path - the index pages above the leaf page
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Merge the leaf with an adjacent sibling if it is below the
+//           merge threshold and both fit in one page, otherwise even
+//           out the entries of the two pages if that gives the leaf
+//           more of them.
+// Note    : This is function for leaf page.  The right sibling is
+//           preferred and the right page of a pair is the one freed, so
+//           that a merge with the right sibling leaves the child's
+//           entries in place.  A pair with a pending split is left as
+//           it is.
+//-------------------------------------------------------------------
+
+Status BTreeFile::ReDistributeMerge(PageID childPid, TreePath& path)
+{
+    BTIndexPage *parentPage;
+    BTLeafPage *leftPage, *rightPage, *nextPage;
+    PageID parentPid, leftPid, rightPid, nextPid;
+    vector<int> keys;
+    vector<PageID> pids;
+    int entryKeys[2 * LEAF_PACKED_CAPACITY];
+    RecordID entryRids[2 * LEAF_PACKED_CAPACITY];
+    int leftNum, rightNum, total, childNum, childCapacity, split;
+    size_t pos;
+    bool underflow;
+
+    parentPid = path.Parent();
+    PIN(parentPid, parentPage);
+    ReadIndexNode(parentPage, keys, pids);
+    pos = find(pids.begin(), pids.end(), childPid) - pids.begin();
+    if ((pos == pids.size()) || (pids.size() < 2))
     {
-        return DONE;
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    if (pos + 1 == pids.size())
+        pos--;
+
+    leftPid = pids[pos];
+    rightPid = pids[pos + 1];
+    if (!path.TryLatchPage(leftPid))
+    {
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    path.LatchPage(rightPid);
+    PIN(leftPid, leftPage);
+    PIN(rightPid, rightPage);
+
+    // A leaf whose split is pending has a sibling the parent does not
+    // know of yet.
+    if (leftPage->SplitPending() || rightPage->SplitPending())
+    {
+        UNPIN(rightPid, CLEAN);
+        UNPIN(leftPid, CLEAN);
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    childCapacity = (childPid == leftPid) ? leftPage->FillCapacity() : rightPage->FillCapacity();
+    leftNum = leftPage->ReadEntries(entryKeys, entryRids);
+    rightNum = rightPage->ReadEntries(entryKeys + leftNum, entryRids + leftNum);
+    total = leftNum + rightNum;
+    childNum = (childPid == leftPid) ? leftNum : rightNum;
+
+    if (Below(childNum, childCapacity, mergeFill)
+        && BTLeafPage::Fits(entryKeys, entryRids, total))
+    {
+        // Merging moves leaf bounds.  Readers that do not latch the
+        // parent learn of it before the right leaf can be reused.
+        ForgetLastLeaf();
+        path.WritePage(parentPid);
+        leftPage->WriteEntries(entryKeys, entryRids, total);
+
+        nextPid = rightPage->GetNextPage();
+        leftPage->SetNextPage(nextPid);
+        if (nextPid != INVALID_PAGE)
+        {
+            path.LatchPage(nextPid);
+            PIN(nextPid, nextPage);
+            nextPage->SetPrevPage(leftPid);
+            UNPIN(nextPid, DIRTY);
+        }
+
+        keys.erase(keys.begin() + pos + 1);
+        pids.erase(pids.begin() + pos + 1);
+        UNPIN(rightPid, CLEAN);
+        path.UnlatchPage(rightPid);
+        FREEPAGE(rightPid);
+        COUNT(counters.leafMerges);
     }
     else
     {
-        PIN(rootPid, (Page *&)rootPage);
+        // The split the entries came in fits, so there is one.
+        split = EvenSplit(entryKeys, entryRids, total);
+        if (((childPid == leftPid) ? split : total - split) <= childNum)
+        {
+            UNPIN(rightPid, CLEAN);
+            UNPIN(leftPid, CLEAN);
+            UNPIN(parentPid, CLEAN);
+            return OK;
+        }
+
+        // So does redistributing.
+        ForgetLastLeaf();
+        path.WritePage(parentPid);
+        leftPage->WriteEntries(entryKeys, entryRids, split);
+        rightPage->WriteEntries(entryKeys + split, entryRids + split, total - split);
+        keys[pos + 1] = entryKeys[split];
+        UNPIN(rightPid, DIRTY);
+        COUNT(counters.leafRedistributions);
     }
+    UNPIN(leftPid, DIRTY);
 
-    type = rootPage->GetType();
+    WriteIndexNode(parentPage, keys, pids);
+    underflow = Below(parentPage->GetNumOfRecords(), parentPage->Capacity(), redistributeFill);
+    UNPIN(parentPid, DIRTY);
 
-    if (type == LEAF_NODE) {
+    // The pages below the parent are done with, and latches are not
+    // taken upwards while they are held.
+    path.UnlatchAfter(parentPid);
+    if (underflow)
+        return IndexReDistributeMerge(path);
 
-		BTLeafPage *leafPage = (BTLeafPage *)rootPage;
+    return OK;
+}
 
-		status = leafPage->Delete(key, rid, outRid);
-        UNPIN(rootPid,CLEAN);
-		if (leafPage->GetNumOfRecords() == 0) {
-			rootPid = INVALID_PAGE;
-		}
+//-------------------------------------------------------------------
+// BTreeFile::IndexReDistributeMerge
+//
+// Input   : path - the index pages down to the page that requires
+//                  ReDistribute and merge, which is the last one
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Merge the index page with an adjacent sibling if it is
+//           below the merge threshold and both fit in one page,
+//           otherwise even out the children of the two if that gives
+//           the page more of them.
+// Note    : This is function for index page.  The separator between
+//           the two pages is pulled down and a new one pushed up.  A
+//           root left with a single child is removed.  A page with a
+//           pending split is neither merged nor removed.
+//-------------------------------------------------------------------
 
-		return status;
-	}
+Status BTreeFile::IndexReDistributeMerge(TreePath& path)
+{
+    BTIndexPage *childPage, *parentPage, *leftPage, *rightPage;
+    PageID childPid, parentPid, leftPid, rightPid;
+    vector<int> keys, leftKeys, rightKeys, allKeys;
+    vector<PageID> pids, leftPids, rightPids, allPids;
+    size_t pos, half, childNum;
+    bool underflow;
+
+    childPid = path.pids[--path.depth];
+    if (path.depth == 0)
+    {
+        // Only a thread holding the root latch may move the root.
+        if (path.Latching() && !path.rootLatched)
+            return OK;
+        PIN(childPid, childPage);
+        if ((childPage->GetNumOfRecords() > 0) || childPage->SplitPending())
+        {
+            UNPIN(childPid, CLEAN);
+            return OK;
+        }
+        path.WriteRoot();
+        path.WritePage(childPid);
+        rootPid = childPage->GetLeftLink();
+        UNPIN(childPid, CLEAN);
+        path.UnlatchPage(childPid);
+        FREEPAGE(childPid);
+        return OK;
+    }
+
+    parentPid = path.Parent();
+    if (!path.Holds(parentPid))
+        return OK;
+    PIN(parentPid, parentPage);
+    ReadIndexNode(parentPage, keys, pids);
+    pos = find(pids.begin(), pids.end(), childPid) - pids.begin();
+    if ((pos == pids.size()) || (pids.size() < 2))
+    {
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    if (pos + 1 == pids.size())
+        pos--;
+
+    leftPid = pids[pos];
+    rightPid = pids[pos + 1];
+    if (!path.TryLatchPage(leftPid))
+    {
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    path.LatchPage(rightPid);
+    PIN(leftPid, leftPage);
+    PIN(rightPid, rightPage);
+    if (leftPage->SplitPending() || rightPage->SplitPending())
+    {
+        UNPIN(rightPid, CLEAN);
+        UNPIN(leftPid, CLEAN);
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    ReadIndexNode(leftPage, leftKeys, leftPids);
+    ReadIndexNode(rightPage, rightKeys, rightPids);
+    childPage = (childPid == leftPid) ? leftPage : rightPage;
+    childNum = (childPid == leftPid) ? leftPids.size() : rightPids.size();
+
+    // Lay out the children of both pages in order, with the separator
+    // from the parent in between.
+    allKeys = leftKeys;
+    allKeys.push_back(keys[pos + 1]);
+    allKeys.insert(allKeys.end(), rightKeys.begin() + 1, rightKeys.end());
+    allPids = leftPids;
+    allPids.insert(allPids.end(), rightPids.begin(), rightPids.end());
+    half = allPids.size() / 2;
+
+    if (Below(childNum - 1, childPage->Capacity(), mergeFill)
+        && ((int)allPids.size() - 1 <= INDEX_DENSE_CAPACITY))
+    {
+        path.WritePage(parentPid);
+        path.WritePage(leftPid);
+        path.WritePage(rightPid);
+        WriteIndexNode(leftPage, allKeys, allPids);
+        keys.erase(keys.begin() + pos + 1);
+        pids.erase(pids.begin() + pos + 1);
+        UNPIN(rightPid, CLEAN);
+        path.UnlatchPage(rightPid);
+        FREEPAGE(rightPid);
+        COUNT(counters.indexMerges);
+    }
+    else if (((childPid == leftPid) ? half : allPids.size() - half) > childNum)
+    {
+        leftKeys.assign(allKeys.begin(), allKeys.begin() + half);
+        leftPids.assign(allPids.begin(), allPids.begin() + half);
+        rightKeys.assign(allKeys.begin() + half, allKeys.end());
+        rightPids.assign(allPids.begin() + half, allPids.end());
+        keys[pos + 1] = allKeys[half];
+
+        path.WritePage(parentPid);
+        path.WritePage(leftPid);
+        path.WritePage(rightPid);
+        WriteIndexNode(leftPage, leftKeys, leftPids);
+        WriteIndexNode(rightPage, rightKeys, rightPids);
+        UNPIN(rightPid, DIRTY);
+        COUNT(counters.indexRedistributions);
+    }
     else
     {
-        UNPIN(rootPid,CLEAN);
-        status =  IndexSearch(rootPid, key, rid, outPid, "delete");
-	}
+        UNPIN(rightPid, CLEAN);
+        UNPIN(leftPid, CLEAN);
+        UNPIN(parentPid, CLEAN);
+        return OK;
+    }
+    UNPIN(leftPid, DIRTY);
 
-    return status;
+    WriteIndexNode(parentPage, keys, pids);
+    underflow = Below(parentPage->GetNumOfRecords(), parentPage->Capacity(), redistributeFill);
+    UNPIN(parentPid, DIRTY);
+
+    // The pages below the parent are done with, and latches are not
+    // taken upwards while they are held.
+    path.UnlatchAfter(parentPid);
+    if (underflow)
+        return IndexReDistributeMerge(path);
+
+    return OK;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::ReDistributeMerge
+// BTreeFile::Lookup
 //
-// Input   : childPid - leaf page id requires ReDistribute and merge
-// Output  : None
-// Return  : OK if successful, FAIL otherwise.
-// Purpose : If ReDistribute is not available, call the merge function.
-// Note    : This is function for leaf page.
+// Input   : key - the key to look up.
+//           maxRids - capacity of rids.
+// Output  : rids - record ids of the matching entries.
+//           numFound - number of record ids written to rids.
+// Return  : OK if at least one entry matches, DONE if none does,
+//           FAIL on error.
+// Purpose : Exact-match lookup without opening a scan.
+// Note    : One page is pinned per level and the leaf is binary
+//           searched.  The record ids of a key are read from its
+//           posting list, if it has one.  The next leaf is only visited
+//           when a run of entries with the key reaches the end of the
+//           current one, as in files written before posting lists.
 //-------------------------------------------------------------------
 
-Status BTreeFile::ReDistributeMerge(PageID childPid)
+Status BTreeFile::Lookup(const int key, RecordID* rids, int maxRids, int& numFound)
 {
-    BTLeafPage *childLeafPage;
-    BTLeafPage *leftSiblingPage, *rightSiblingPage, *siblingLeafPage;
-    PageID leftSiblingPageID, rightSiblingPageID, curPageID, lastPid;
-
-    int firstKey, lastKey, outKey;
-    RecordID firstRid, outRid, curRid;
-
-    PageID indexPageID = path.top();
-
-    BTIndexPage *indexPage;
-
-    PIN(indexPageID, (Page *&)indexPage);
-    PIN(childPid, (Page *&)childLeafPage);
+    BTLeafPage *leafPage;
+    PageID pageID, nextPid;
+    RecordID curRid, dataRid;
+    TreePath path;
+    int entryKey;
+    Status status;
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
 
-    int totalSlots = HEAPPAGE_DATA_SIZE/INSERTSIZE;
-    int selfSlots = (HEAPPAGE_DATA_SIZE - childLeafPage-> AvailableSpace ())/INSERTSIZE;
+    if (threadSafe)
+        path.StartLatching(&rootLatch, &rootVersion, LATCH_SHARED);
+    numFound = 0;
+    if (rootPid == INVALID_PAGE)
+        return DONE;
 
-    leftSiblingPageID = childLeafPage->GetPrevPage();
-    rightSiblingPageID = childLeafPage->GetNextPage();
+    if (Descend<SearchOp>(key, path, pageID, leafPage) != OK)
+        return FAIL;
 
-    PageID tempID = indexPage -> GetLeftLink();
-    indexPage->GetLast(lastKey, lastPid, outRid);
+    curRid.pageNo = pageID;
+    curRid.slotNo = leafPage->LowerBound(key);
+    status = leafPage->GetCurrent(entryKey, dataRid, curRid);
 
-    if(childPid != lastPid)
+    while ((status == OK) && (entryKey == key) && (numFound < maxRids))
     {
-
-        PIN(rightSiblingPageID, (Page *&)rightSiblingPage);
-
-        int siblingSlots = (HEAPPAGE_DATA_SIZE - rightSiblingPage-> AvailableSpace ())/INSERTSIZE;
-
-        if(rightSiblingPage-> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
+        status = VisitRids(dataRid, [&](const RecordID& rid) {
+            rids[numFound++] = rid;
+            return numFound < maxRids;
+        });
+        if (status != OK)
+            break;
+        status = leafPage->GetNext(entryKey, dataRid, curRid);
+
+        if ((status == DONE) && (leafPage->GetNextPage() != INVALID_PAGE))
         {
+            nextPid = leafPage->GetNextPage();
+            UNPIN(pageID, CLEAN);
+            pageID = nextPid;
+            path.LatchPage(pageID);
+            path.UnlatchAbove();
+            PIN(pageID, leafPage);
+            status = leafPage->GetFirst(entryKey, dataRid, curRid);
+        }
+    }
+    UNPIN(pageID, CLEAN);
 
-            rightSiblingPage->GetFirst(firstKey,  firstRid, outRid);
-            indexPage -> Search(firstKey, curPageID, outKey);
-            indexPage -> Delete(outKey, outRid);
+    if (status == FAIL)
+        return FAIL;
+    return (numFound > 0) ? OK : DONE;
+}
 
-            while (( childLeafPage->AvailableSpace () > HEAPPAGE_DATA_SIZE / 2)
-            &&( rightSiblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
-            {
-                rightSiblingPage->GetFirst(firstKey,  firstRid, outRid);
-                childLeafPage -> Insert(firstKey,  firstRid, outRid);
-                rightSiblingPage->Delete(firstKey, firstRid, outRid);
-            }
+//-------------------------------------------------------------------
+// BTreeFile::MultiLookup
+//
+// Input   : keys - the keys to look up, best sorted ascending.
+//           numKeys - number of keys.
+//           callback - called with context for every matching entry.
+// Output  : numPins - number of pages pinned for the batch.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Exact-match lookup of a batch of keys in one walk.
+// Note    : The index pages on the current path stay pinned together
+//           with the key range each covers.  A key only unpins the
+//           levels whose range it falls outside of, so consecutive
+//           keys under the same child share the upper levels.  A key
+//           just past the current leaf and its parent tries the next
+//           leaf in the chain before climbing back up.  Whatever the
+//           walk leaves pinned is unpinned here, also when it fails.
+//
+//           A thread-safe tree is shared with other readers and
+//           writers; see LatchedMultiLookup.
+//-------------------------------------------------------------------
 
-            rightSiblingPage->GetFirst(firstKey,  firstRid, outRid);
-            indexPage -> Insert(firstKey,  rightSiblingPageID, outRid);
+Status BTreeFile::MultiLookup(const int* keys, int numKeys, LookupCallback callback, void* context, long& numPins)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_SHARED);
+    vector<PinnedNode> pinned;
+    PinnedNode leaf;
+    long pinsBefore;
+    Status status;
 
+    if (threadSafe)
+        return LatchedMultiLookup(keys, numKeys, callback, context, numPins);
 
-            if(( childLeafPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
-            &&( rightSiblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
-            {
-                UNPIN(rightSiblingPageID, DIRTY);
-                UNPIN(childPid, DIRTY);
-                UNPIN(indexPageID, DIRTY);
-                return OK;
-            }
-        }
-        if((siblingSlots+selfSlots)<=totalSlots)
-            MergeLeaf(childLeafPage, rightSiblingPage, indexPage, "right");
+    pinsBefore = BufferLatch::Pins();
+    leaf.pid = INVALID_PAGE;
+    status = MultiLookupKeys(keys, numKeys, callback, context, pinned, leaf);
 
-        UNPIN(rightSiblingPageID, DIRTY);
-        UNPIN(childPid, DIRTY);
-        UNPIN(indexPageID, DIRTY);
-        return OK;
-    }
-    else
+    if ((leaf.pid != INVALID_PAGE) && (BufferLatch::UnpinPage(leaf.pid, CLEAN) != OK))
+        status = FAIL;
+    for (size_t i = 0; i < pinned.size(); i++)
     {
-            PIN(leftSiblingPageID, (Page *&)leftSiblingPage);
-            int siblingSlots = (HEAPPAGE_DATA_SIZE - leftSiblingPage-> AvailableSpace ())/INSERTSIZE;
-            if(leftSiblingPage-> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
-            {
-
-                childLeafPage->GetFirst(firstKey,  firstRid, outRid);
-                indexPage -> Search(firstKey, curPageID, outKey);
-                indexPage -> Delete(outKey, outRid);
-                while (( childLeafPage -> AvailableSpace () > HEAPPAGE_DATA_SIZE / 2)
-                &&( leftSiblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
-                {
-                    leftSiblingPage->GetLast(firstKey,  firstRid, outRid);
-                    childLeafPage -> Insert(firstKey,  firstRid, outRid);
-                    leftSiblingPage->Delete(firstKey, firstRid, outRid);
-                }
-                childLeafPage->GetFirst(firstKey,  firstRid, outRid);
-                indexPage -> Insert(firstKey,  childPid, outRid);
-                if(( childLeafPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
-                &&( leftSiblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
-                {
-                    UNPIN(leftSiblingPageID, DIRTY);
-                    UNPIN(childPid, DIRTY);
-                    UNPIN(indexPageID, DIRTY);
-                    return OK;
-                }
-            }
-            if((siblingSlots+selfSlots)<=totalSlots)
-                MergeLeaf(childLeafPage, leftSiblingPage, indexPage, "left");
-            leftSiblingPage->GetLast(firstKey,  firstRid, outRid);
-
-            UNPIN(leftSiblingPageID, DIRTY);
-            UNPIN(childPid, DIRTY);
-            UNPIN(indexPageID, DIRTY);
-            return OK;
-
+        if (BufferLatch::UnpinPage(pinned[i].pid, CLEAN) != OK)
+            status = FAIL;
     }
 
-
-    return DONE;
+    numPins = BufferLatch::Pins() - pinsBefore;
+    return status;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::IndexReDistributeMerge
+// BTreeFile::MultiLookupKeys
 //
-// Input   : childPid - index page id requires ReDistribute and merge
-//           childIndexPage - index page requires ReDistribute and merge
-//           siblingIndexID - sibling page id of target index page
-//           right - the position of the sibling page
-// Output  : None
+// Input   : keys, numKeys, callback, context - as for MultiLookup.
+//           pinned - the index pages on the path, pinned, top first.
+//           leaf - the pinned leaf, or INVALID_PAGE.
+// Output  : pinned, leaf - what is pinned when the walk ends.
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : If ReDistribute is not available, call the merge function.
-// Note    : This is function for index page.
+// Purpose : The walk of MultiLookup.  A page is only in pinned or leaf
+//           while it is pinned, so the caller can unpin them whether
+//           the walk succeeds or not.
 //-------------------------------------------------------------------
 
-Status BTreeFile::IndexReDistributeMerge(PageID childPid, BTIndexPage *childIndexPage, PageID siblingIndexID, bool right)
+Status BTreeFile::MultiLookupKeys(const int* keys, int numKeys, LookupCallback callback, void* context,
+                                  vector<PinnedNode>& pinned, PinnedNode& leaf)
 {
-    BTIndexPage *siblingPage;
-    PageID leftSiblingPageID, rightSiblingPageID, curPageID, lastPid;
-
-    int firstKey, lastKey, parentKey;
-    RecordID firstRid, outRid;
-    PageID firstPid, parentPid;
-
-    bool leftDistribute = false;
-    bool rightDistribute = false;
-
-    PageID indexPageID = path.top();
+    PinnedNode node;
     BTIndexPage *indexPage;
+    BTLeafPage *leafPage;
+    RecordID curRid, dataRid;
+    int entryKey, slot;
+    bool moved;
+    Status status;
 
-    PIN(indexPageID, (Page *&)indexPage);
-    PIN(siblingIndexID, (Page *&)siblingPage);
-
-    int totalSlots = HEAPPAGE_DATA_SIZE/INDEXENTRYSIZE;
-    int siblingSlots = (HEAPPAGE_DATA_SIZE - siblingPage-> AvailableSpace ())/INDEXENTRYSIZE;
-    int selfSlots = (HEAPPAGE_DATA_SIZE - childIndexPage-> AvailableSpace ())/INDEXENTRYSIZE;
-
-    if(right)
+    for (int i = 0; (i < numKeys) && (rootPid != INVALID_PAGE); i++)
     {
-        if(siblingPage-> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
+        const int key = keys[i];
+
+        moved = false;
+        if ((leaf.pid != INVALID_PAGE) && !leaf.Covers(key) && leaf.hasHigh && (key >= leaf.high)
+            && (pinned.empty() || !pinned.back().Covers(key)))
         {
+            if (SlideToNextLeaf(leaf, key, moved) != OK)
+                return FAIL;
+        }
 
-            while (( childIndexPage -> AvailableSpace () > HEAPPAGE_DATA_SIZE / 2)
-            &&( siblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
+        if ((leaf.pid == INVALID_PAGE) || !leaf.Covers(key))
+        {
+            if (leaf.pid != INVALID_PAGE)
             {
-                siblingPage->GetFirst(firstKey,  firstPid, outRid);
-                indexPage->Search(firstKey, parentPid, parentKey);
-                childIndexPage -> Insert(parentKey,  siblingPage->GetLeftLink(), outRid);
-                siblingPage -> SetLeftLink(firstPid);
-                indexPage -> changeKey(firstKey, parentKey);
-                siblingPage->Delete(firstKey, outRid);
+                UNPIN(leaf.pid, CLEAN);
+                leaf.pid = INVALID_PAGE;
+            }
+            while (!pinned.empty() && !pinned.back().Covers(key))
+            {
+                UNPIN(pinned.back().pid, CLEAN);
+                pinned.pop_back();
             }
 
-
-            if(( childIndexPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
-            &&( siblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
+            if (pinned.empty())
             {
-                UNPIN(siblingIndexID, DIRTY);
-                UNPIN(indexPageID, DIRTY);
-                return OK;
+                node.pid = rootPid;
+                node.hasLow = node.hasHigh = false;
+                PIN(node.pid, node.page);
             }
-        }
-        if((siblingSlots+selfSlots)<totalSlots)
-            MergeIndex(childIndexPage, siblingPage, indexPage, "right");
-        UNPIN(siblingIndexID, DIRTY);
-        UNPIN(indexPageID, DIRTY);
-        return OK;
-    }
-    else
-    {
-            if(siblingPage-> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
+            else
             {
+                node = pinned.back();
+                pinned.pop_back();
+            }
 
-                while (( childIndexPage -> AvailableSpace () > HEAPPAGE_DATA_SIZE / 2)
-                &&( siblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
-                {
-
-                    siblingPage->GetLast(firstKey,  firstPid, outRid);
-
-                    indexPage->leftSearch(firstKey, parentPid, parentKey);
-
-                    childIndexPage -> Insert(parentKey,  childIndexPage->GetLeftLink(), outRid);
-                    childIndexPage -> SetLeftLink(firstPid);
+            // Descend to the leaf, narrowing the range at every level.
+            while (node.page->GetType() == INDEX_NODE)
+            {
+                pinned.push_back(node);
+                indexPage = (BTIndexPage *)node.page;
 
-                    indexPage -> changeKey(firstKey, parentKey);
-                    // indexPage->Delete(parentKey, outRid);
-                    // indexPage-> Insert(firstKey,  childPid, outRid);
-                    // indexPage-> Insert(firstKey,  childPid, outRid);
-                    siblingPage->Delete(firstKey, outRid);
+                slot = indexPage->UpperBound(key);
+                if (slot == 0)
+                {
+                    node.pid = indexPage->GetLeftLink();
                 }
-
-                if(( childIndexPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2)
-                &&( siblingPage -> AvailableSpace () <= HEAPPAGE_DATA_SIZE / 2))
+                else
                 {
-
-                    UNPIN(siblingIndexID, DIRTY);
-                    UNPIN(indexPageID, DIRTY);
-                    return OK;
+                    node.pid = indexPage->GetEntry(slot - 1).pid;
+                    node.hasLow = true;
+                    node.low = indexPage->GetEntry(slot - 1).key;
+                }
+                if (slot < indexPage->GetNumOfRecords())
+                {
+                    node.hasHigh = true;
+                    node.high = indexPage->GetEntry(slot).key;
                 }
+                PIN(node.pid, node.page);
             }
+            leaf = node;
+        }
 
-            if((siblingSlots+selfSlots)<totalSlots)
-                MergeIndex(childIndexPage, siblingPage, indexPage, "left");
-            UNPIN(siblingIndexID, DIRTY);
-            UNPIN(indexPageID, DIRTY);
+        leafPage = (BTLeafPage *)leaf.page;
+        curRid.pageNo = leaf.pid;
+        curRid.slotNo = leafPage->LowerBound(key);
+        status = leafPage->GetCurrent(entryKey, dataRid, curRid);
 
-            return OK;
+        while ((status == OK) && (entryKey == key))
+        {
+            status = VisitRids(dataRid, [&](const RecordID& rid) {
+                callback(key, rid, context);
+                return true;
+            });
+            if (status != OK)
+                return FAIL;
+            status = leafPage->GetNext(entryKey, dataRid, curRid);
+
+            // A run of duplicates may continue in the next leaf.
+            if ((status == DONE) && (leafPage->GetNextPage() != INVALID_PAGE))
+            {
+                if (SlideToNextLeaf(leaf, key, moved) != OK)
+                    return FAIL;
+                if (!moved)
+                    break;
+                leafPage = (BTLeafPage *)leaf.page;
+                status = leafPage->GetFirst(entryKey, dataRid, curRid);
+            }
+        }
     }
-    return DONE;
+
+    return OK;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::MergeIndex
+// BTreeFile::LatchedMultiLookup
 //
-// Input   : childIndexPage - index page that needs to merge
-//           siblingPage - sibling page of index page
-//           siblingIndexID - sibling page id of target index page
-//           flag - the position of the sibling page
-// Output  : None
+// Input   : keys, numKeys, callback, context - as for MultiLookup.
+// Output  : numPins - number of pages pinned for the batch.
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Merge the target page and its siblingPage.
-// Note    : This is function for index page.
+// Purpose : MultiLookup on a thread-safe tree, which writers may change
+//           meanwhile.
+// Note    : No index page stays pinned between keys, as writers may
+//           split or merge it.  A key walks down as Lookup does, unless
+//           it lies within the keys of the leaf of the key before,
+//           which stays latched for it.
 //-------------------------------------------------------------------
 
-Status BTreeFile::MergeIndex(BTIndexPage *childIndexPage, BTIndexPage *siblingPage, BTIndexPage *indexPage, string flag)
+Status BTreeFile::LatchedMultiLookup(const int* keys, int numKeys, LookupCallback callback, void* context, long& numPins)
 {
-    int firstKey, indexKey, parentKey;
-    RecordID firstRid, outRid, indexRid;
-    PageID firstPid, indexPid, parentPid;
-    PageID leftMostID;
+    BTLeafPage *leafPage;
+    PageID leafPid, nextPid;
+    RecordID curRid, dataRid;
+    TreePath path;
+    int entryKey, numRecords;
+    long pinsBefore;
+    Status status = OK;
 
-    if(flag == "right")
-    {
-        siblingPage->GetFirst(indexKey,  indexPid, indexRid);
-        indexPage->Search(indexKey, parentPid, parentKey);
-        childIndexPage -> Insert(parentKey,  siblingPage->GetLeftLink(), outRid);
-    }
-    else
-    {
-        childIndexPage->GetFirst(indexKey,  indexPid, indexRid);
-        indexPage->Search(indexKey, parentPid, parentKey);
-        siblingPage->Insert(parentKey,  childIndexPage->GetLeftLink(), outRid);
-    }
-    indexPage ->Delete(parentKey, indexRid);
-    if(flag == "right")
+    pinsBefore = BufferLatch::Pins();
+    path.StartLatching(&rootLatch, &rootVersion, LATCH_SHARED);
+    leafPid = INVALID_PAGE;
+
+    for (int i = 0; (i < numKeys) && (status != FAIL) && (rootPid != INVALID_PAGE); i++)
     {
-        while(siblingPage->GetNumOfRecords() > 0)
+        const int key = keys[i];
+
+        if (leafPid != INVALID_PAGE)
         {
-            siblingPage->GetFirst(firstKey,  firstPid, outRid);
-            childIndexPage->Insert(firstKey,  firstPid, outRid);
-            siblingPage->Delete(firstKey, outRid);
+            numRecords = leafPage->GetNumOfRecords();
+            if ((numRecords == 0) || (key < leafPage->GetKey(0)) || (key > leafPage->GetKey(numRecords - 1)))
+            {
+                UNPIN(leafPid, CLEAN);
+                path.UnlatchAll();
+                leafPid = INVALID_PAGE;
+            }
         }
+        if ((leafPid == INVALID_PAGE) && (Descend<SearchOp>(key, path, leafPid, leafPage) != OK))
+            return FAIL;
 
-    }
-    else
-    {
-        while(childIndexPage->GetNumOfRecords() > 0)
+        curRid.pageNo = leafPid;
+        curRid.slotNo = leafPage->LowerBound(key);
+        status = leafPage->GetCurrent(entryKey, dataRid, curRid);
+
+        while ((status == OK) && (entryKey == key))
         {
+            status = VisitRids(dataRid, [&](const RecordID& rid) {
+                callback(key, rid, context);
+                return true;
+            });
+            if (status != OK)
+                break;
+            status = leafPage->GetNext(entryKey, dataRid, curRid);
 
-            childIndexPage->GetFirst(firstKey,  firstPid, outRid);
-            siblingPage->Insert(firstKey,  firstPid, outRid);
-            childIndexPage->Delete(firstKey, outRid);
+            // A run of duplicates may continue in the next leaf.
+            if ((status == DONE) && (leafPage->GetNextPage() != INVALID_PAGE))
+            {
+                nextPid = leafPage->GetNextPage();
+                UNPIN(leafPid, CLEAN);
+                path.LatchPage(nextPid);
+                path.UnlatchPage(leafPid);
+                leafPid = nextPid;
+                PIN(leafPid, leafPage);
+                status = leafPage->GetFirst(entryKey, dataRid, curRid);
+            }
         }
-
     }
 
-    return OK;
+    if (leafPid != INVALID_PAGE)
+    {
+        UNPIN(leafPid, CLEAN);
+    }
+    numPins = BufferLatch::Pins() - pinsBefore;
+    return (status == FAIL) ? FAIL : OK;
 }
 
 //-------------------------------------------------------------------
-// BTreeFile::MergeLeaf
+// BTreeFile::SlideToNextLeaf
 //
-// Input   : childLeafPage - leaf page that needs to merge
-//           siblingPage - sibling page of leaf page
-//           indexPage - parent page id of target leaf page
-//           flag - the position of the sibling page
-// Output  : None
+// Input   : leaf - the pinned leaf to move from.
+//           key - the key being looked up.
+// Output  : leaf - the next leaf in the chain, if moved.
+//           moved - true if leaf was replaced by the next leaf.
 // Return  : OK if successful, FAIL otherwise.
-// Purpose : Merge the target page and its siblingPage.
-// Note    : This is function for leaf page.
+// Purpose : Move to the next leaf when it is known to cover key, i.e.
+//           key is not greater than its last key or it is the last
+//           leaf.  The range of the new leaf is only known up to its
+//           last key, which is safe to use for the following keys.
 //-------------------------------------------------------------------
 
-Status BTreeFile::MergeLeaf(BTLeafPage *childLeafPage, BTLeafPage *siblingPage, BTIndexPage *indexPage, string flag)
+Status BTreeFile::SlideToNextLeaf(PinnedNode& leaf, const int key, bool& moved)
 {
-    int firstKey, indexKey, leafKey;
-    RecordID firstRid, outRid, leafRid, indexRid;
-    PageID leftMostID, indexPid;
+    BTLeafPage *nextPage;
+    PageID nextPid, prevPid;
+    RecordID dataRid, outRid;
+    int lastKey;
+    bool isLast, hasLast;
+
+    moved = false;
+    nextPid = leaf.page->GetNextPage();
+    if (nextPid == INVALID_PAGE)
+        return OK;
 
-    if(flag == "right")
-    {
-        siblingPage->GetFirst(leafKey,  leafRid, outRid);
-        indexPage -> Search(leafKey, indexPid, indexKey);
-    }
-    else
-    {
-        childLeafPage->GetFirst(leafKey,  leafRid, outRid);
-        indexPage -> Search(leafKey, indexPid, indexKey);
-    }
+    PIN(nextPid, nextPage);
+    isLast = (nextPage->GetNextPage() == INVALID_PAGE);
+    hasLast = (nextPage->GetLast(lastKey, dataRid, outRid) == OK);
 
-    if(flag == "right")
-    {
-        while(siblingPage->GetNumOfRecords() > 0)
-        {
-            siblingPage->GetFirst(firstKey,  firstRid, outRid);
-            childLeafPage->Insert(firstKey,  firstRid, outRid);
-            siblingPage->Delete(firstKey, firstRid, outRid);
-        }
-    }
-    else
+    if (!isLast && !(hasLast && (key <= lastKey)))
     {
-        while(childLeafPage->GetNumOfRecords() > 0)
-        {
-            childLeafPage->GetFirst(firstKey,  firstRid, outRid);
-            siblingPage->Insert(firstKey,  firstRid, outRid);
-            childLeafPage->Delete(firstKey, firstRid, outRid);
-        }
+        UNPIN(nextPid, CLEAN);
+        return OK;
     }
 
-
-    if(flag == "right")
-    {
-        PageID nextPageID = siblingPage->GetNextPage();
-        childLeafPage->SetNextPage(nextPageID);
-        indexPage ->Delete(indexKey, indexRid);
-    }
-    else
-    {
-        PageID nextPageID = childLeafPage->GetNextPage();
-        siblingPage->SetNextPage(nextPageID);
-        indexPage ->Delete(indexKey, indexRid);
-    }
-    childLeafPage ->GetLast(firstKey,  indexRid, outRid);
+    // The new leaf takes the place of the old one before the old one is
+    // unpinned, so that leaf is pinned even if the unpin fails.
+    prevPid = leaf.pid;
+    leaf.hasLow = leaf.hasHigh;
+    leaf.low = leaf.high;
+    leaf.hasHigh = !isLast && (lastKey < INT_MAX);
+    leaf.high = lastKey + (leaf.hasHigh ? 1 : 0);
+    leaf.pid = nextPid;
+    leaf.page = nextPage;
+    moved = true;
+    UNPIN(prevPid, CLEAN);
 
     return OK;
 }
@@ -1061,6 +3610,7 @@ Status BTreeFile::MergeLeaf(BTLeafPage *childLeafPage, BTLeafPage *siblingPage,
 //
 // Input   : lowKey, highKey - pointer to keys, indicate the range
 //                             to scan.
+//           snapshot - whether to scan the index as it is now.
 // Output  : None
 // Return  : A pointer to IndexFileScan class.
 // Purpose : Initialize a scan.
@@ -1074,119 +3624,145 @@ Status BTreeFile::MergeLeaf(BTLeafPage *childLeafPage, BTLeafPage *siblingPage,
 //           !nullptr    nullptr      lowKey to maximum
 //           !nullptr    =lowKey  	  exact match
 //           !nullptr    >lowKey      lowKey to highKey
+//
+//           A scan otherwise sees the changes made while it is open.
+//           In thread-safe mode it latches the leaves it reads, and
+//           between calls keeps the versions of its pages and finds
+//           its place again from the pair it returned last if they
+//           moved on.  A snapshot scan is opened while no writer is
+//           in, and is positioned on the tree as it is then.  From
+//           then on, writers preserve the pages they pin or free for
+//           it, and it reads leaves and posting pages from those
+//           copies or from pages that have not changed.  The copies
+//           are freed when the scan is deleted.
 //-------------------------------------------------------------------
 
 IndexFileScan*
-BTreeFile::OpenScan(const int* lowKey, const int* highKey)
+BTreeFile::OpenScan(const int* lowKey, const int* highKey, bool snapshot)
 {
-    RecordID rid;
-    int key, tempkey;
-    RecordID outRid, tempRid;
-
-	PageID rootPageID, outPid;
-	PageID startPageID;
-    BTLeafPage *startPage;
-    clearPath();
-
+	EpochGuard epoch(threadSafe);
+	LatchGuard guard(TreeLatch(), snapshot ? LATCH_EXCLUSIVE : LATCH_SHARED);
 	BTreeFileScan* scan=new BTreeFileScan();
-
+	bool exact;
 
 	scan->setFlag("start");
     scan->setHighKey(highKey);
     scan->setLowKey(lowKey);
     scan->setBtf(this);
+    scan->snapshot = snapshot ? snapshots.Open() : nullptr;
+    scan->leafCopy.pid = INVALID_PAGE;
+    scan->postCopy.pid = INVALID_PAGE;
 
-	if (rootPid == INVALID_PAGE){
-
-		scan->setPid(INVALID_PAGE);
-		return scan;
-	}
+    PositionScan(scan, lowKey, nullptr, exact);
 
-	if (rootPid!=INVALID_PAGE) {
+	return scan;
+}
 
-		if (lowKey == nullptr)
-        {
-			startPageID = GetLeftLeaf(rootPid);
-		}
-        else
-        {
-            scan->setLowKey(lowKey);
-			if (IndexSearch(rootPid, *lowKey, rid, outPid, "search") != OK)
-            {
-                return scan;
-            }
-            scan->setPid(outPid);
+//-------------------------------------------------------------------
+// BTreeFile::PositionScan
+//
+// Input   : scan - the scan to move.
+//           key - pointer to the key to start from, nullptr for the
+//                 first entry of the index.
+//           rid - pointer to the record id to start from among those
+//                 of key, nullptr for the first one.
+// Output  : exact - whether the scan is on the pair given.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Point the scan at the first (key, rid) pair that is not
+//           less than the one given.  The scan's pid is INVALID_PAGE
+//           if there is no such pair.
+// Note    : In thread-safe mode the leaf is latched while the scan is
+//           placed on it, and the scan remembers the versions of its
+//           pages before the latch is let go of.
+//-------------------------------------------------------------------
 
-            startPageID = outPid;
-		}
+Status BTreeFile::PositionScan(BTreeFileScan* scan, const int* key, const RecordID* rid, bool& exact)
+{
+    RecordID scanRid, dataRid;
+	PageID startPageID, nextPageID;
+    BTLeafPage *startPage;
+    BTPostingPage *postPage;
+    TreePath path;
+    int slot = 0;
 
+    scan->setPid(INVALID_PAGE);
+    scan->postPid = INVALID_PAGE;
+    scan->postSlot = 0;
+    exact = false;
 
+	if (rootPid == INVALID_PAGE){
 
-		MINIBASE_BM->PinPage(startPageID, (Page *&)startPage);
-		if (startPage->GetNumOfRecords() <= 0) {
-			return scan;
-		}
+		return OK;
+	}
 
-		startPage->GetFirst(key, outRid, rid);
+    if (threadSafe)
+        path.StartLatching(&rootLatch, &rootVersion, LATCH_SHARED);
+    if (Descend<SearchOp>((key == nullptr) ? INT_MIN : *key, path, startPageID, startPage) != OK)
+    {
+        return FAIL;
+	}
 
-		if (lowKey != nullptr)
+	if (key != nullptr)
+    {
+        slot = startPage->LowerBound(*key);
+        if ((rid != nullptr) && (slot < startPage->GetNumOfRecords())
+            && (startPage->GetKey(slot) == *key))
         {
-            startPage->GetLast(tempkey, outRid, tempRid);
-            if(*lowKey>tempkey)
+            dataRid = startPage->GetEntry(slot).rid;
+            if (IsPostingList(dataRid))
             {
-                scan->setPid(INVALID_PAGE);
-
-                return scan;
+                if (FindInPostingList(dataRid, *rid, scan->postPid, scan->postSlot) != OK)
+                {
+                    UNPIN(startPageID, CLEAN);
+                    return FAIL;
+                }
+                if (scan->postPid == INVALID_PAGE)
+                    slot++;
+                else
+                {
+                    PIN(scan->postPid, postPage);
+                    exact = (postPage->GetRid(scan->postSlot) == *rid);
+                    UNPIN(scan->postPid, CLEAN);
+                }
+            }
+            else if (dataRid < *rid)
+            {
+                slot++;
             }
             else
             {
-                while(*lowKey > key)
-                {
-    				startPage->GetNext(key, outRid, rid);
-    			}
+                exact = (dataRid == *rid);
             }
-
-		}
-        else
-        {
-            scan->setLowKey(&key);
-            scan->setPid(startPageID);
         }
-		scan->setRid(rid);
-
-
-		MINIBASE_BM->UnpinPage(startPageID, CLEAN);
 	}
 
-	return scan;
-}
-
-//-------------------------------------------------------------------
-// BTreeFile::GetLeftLeaf
-//
-// Input   : parentPid - root of the tree to get left most page.
-// Output  : None
-// Return  : OK if successful, FAIL otherwise.
-// Purpose : Recursively find the leftmost page.
-// Note    : This is used in scan. When input -1 as lowkey, we need to set it leftmost.
-//-------------------------------------------------------------------
-
-PageID BTreeFile::GetLeftLeaf(PageID parentPid)
-{
-    SortedPage *parentPage;
-    PIN(parentPid, (Page *&)parentPage);
-    short type = parentPage->GetType();
-
-    if(type==LEAF_NODE)
+    // Every key of the next leaf is at least the separator above key,
+    // so the scan starts there if key is past this leaf.  The latch of
+    // this leaf keeps the next one from being freed meanwhile.
+    if (slot >= startPage->GetNumOfRecords())
     {
-        UNPIN(parentPid, CLEAN);
-        return parentPid;
+        nextPageID = startPage->GetNextPage();
+        UNPIN(startPageID, CLEAN);
+        if (nextPageID != INVALID_PAGE)
+        {
+            scanRid.pageNo = nextPageID;
+            scanRid.slotNo = 0;
+            scan->setPid(nextPageID);
+            scan->setRid(scanRid);
+            scan->RememberPages();
+        }
+        return OK;
     }
 
-    PageID leftChild = parentPage->GetPrevPage();
-    UNPIN(parentPid, CLEAN);
-    return GetLeftLeaf(leftChild);
+    scanRid.pageNo = startPageID;
+    scanRid.slotNo = slot;
+    scan->setPid(startPageID);
+	scan->setRid(scanRid);
+    scan->RememberPages();
+
+	UNPIN(startPageID, CLEAN);
 
+	return OK;
 }
 
 //-------------------------------------------------------------------
@@ -1284,12 +3860,18 @@ BTreeFile::PrintNode(PageID pageID)
 			while (s != DONE)
 			{
 				i++;
-				cout << "DataRecord ID: " << dataRid << " Key: " << key << endl;
+				VisitRids(dataRid, [&](const RecordID& rid) {
+					cout << "DataRecord ID: " << rid << " Key: " << key << endl;
+					return true;
+				});
 				s = leaf->GetNext(key, dataRid, currRid);
 			}
 			cout << "\n This page contains  " << i << "  entries." << endl;
 			break;
 		}
+
+		default:
+			break;
 	}
 	UNPIN(pageID, CLEAN);
 
@@ -1303,19 +3885,65 @@ BTreeFile::PrintNode(PageID pageID)
 // Output  : None
 // Return  : None
 // Purpose : Print out this B+ Tree
+// Note    : A tree emptied by deletes keeps its root leaf, but is
+//           printed as before, when it lost its root: as the banner
+//           alone.
 //-------------------------------------------------------------------
 
 Status
 BTreeFile::Print()
 {
+	EpochGuard epoch(threadSafe);
+	LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+	SortedPage* rootPage = nullptr;
+	bool empty;
+
 	cout << "\n\n-------------- Now Begin Printing a new whole B+ Tree -----------" << endl;
 
+	if (rootPid != INVALID_PAGE)
+	{
+		PIN(rootPid, rootPage);
+		empty = (rootPage->GetType() == LEAF_NODE) && (rootPage->GetNumOfRecords() == 0);
+		UNPIN(rootPid, CLEAN);
+		if (empty)
+			return OK;
+	}
+
 	if (PrintTree(rootPid) == OK)
 		return OK;
 
 	return FAIL;
 }
 
+//-------------------------------------------------------------------
+// BTreeFile::SetRebalanceThresholds
+//
+// Input   : mergeBelow - the fill factor below which a node is merged
+//                        with a sibling, in [0, 0.5].
+//           redistributeBelow - the fill factor below which a node
+//                               takes entries from a sibling, in
+//                               [mergeBelow, 1].
+// Output  : None
+// Return  : OK if successful, FAIL if a threshold is out of range.
+// Purpose : Tune when deletes rebalance the tree.
+// Note    : A split leaves two nodes about half full, so merging above
+//           that would merge them again after a few deletes.  A node
+//           without entries is merged regardless.
+//-------------------------------------------------------------------
+
+Status BTreeFile::SetRebalanceThresholds(float mergeBelow, float redistributeBelow)
+{
+    EpochGuard epoch(threadSafe);
+    LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+    if (mergeBelow < 0 || mergeBelow > 0.5 || redistributeBelow < mergeBelow
+        || redistributeBelow > 1)
+        return FAIL;
+
+    mergeFill = mergeBelow;
+    redistributeFill = redistributeBelow;
+    return OK;
+}
+
 //-------------------------------------------------------------------
 // BTreeFile::DumpStatistics
 //
@@ -1329,10 +3957,104 @@ BTreeFile::Print()
 //           4. Mean, Min, and max fill factor of leaf nodes and
 //              index nodes.
 //           5. Height of the tree.
+//           6. The same for the pages of posting lists.
+//           7. Splits, merges and redistributions since the file
+//              was opened.
 //-------------------------------------------------------------------
 Status
 BTreeFile::DumpStatistics()
 {
-	// TODO: add your code here
+	EpochGuard epoch(threadSafe);
+	LatchGuard guard(TreeLatch(), LATCH_EXCLUSIVE);
+	NodeStatistics leaves = { 0, 0, 0.0, 1.0, 0.0 };
+	NodeStatistics indexes = { 0, 0, 0.0, 1.0, 0.0 };
+	NodeStatistics postings = { 0, 0, 0.0, 1.0, 0.0 };
+	int height = 0;
+
+	if (rootPid != INVALID_PAGE &&
+		CollectStatistics(rootPid, 1, leaves, indexes, postings, height) != OK)
+		return FAIL;
+
+	cout << "\n-------------- B+ Tree Statistics -----------" << endl;
+	cout << "Height: " << height << endl;
+
+	const char *names[3] = { "Leaf", "Index", "Posting" };
+	NodeStatistics *stats[3] = { &leaves, &indexes, &postings };
+	for (int i = 0; i < 3; i++)
+	{
+		cout << names[i] << " nodes: " << stats[i]->nodes
+			<< "  entries: " << stats[i]->entries << endl;
+		if (stats[i]->nodes > 0)
+		{
+			cout << "  Fill factor (%): mean " << 100 * stats[i]->sumFill / stats[i]->nodes
+				<< "  min " << 100 * stats[i]->minFill
+				<< "  max " << 100 * stats[i]->maxFill << endl;
+		}
+	}
+
+	cout << "Splits: leaf " << counters.leafSplits
+		<< "  index " << counters.indexSplits << endl;
+	cout << "Merges: leaf " << counters.leafMerges
+		<< "  index " << counters.indexMerges << endl;
+	cout << "Redistributions: leaf " << counters.leafRedistributions
+		<< "  index " << counters.indexRedistributions << endl;
+
 	return OK;
 }
+
+//-------------------------------------------------------------------
+// BTreeFile::CollectStatistics
+//
+// Input   : pageID - root of the subtree to visit.
+//           level - the level of pageID, 1 for the root.
+// Output  : leaves, indexes, postings - updated with every node and
+//                                       posting page of the subtree.
+//           height - raised to the deepest level seen.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Gather the counts and fill factors for DumpStatistics.
+//-------------------------------------------------------------------
+
+Status
+BTreeFile::CollectStatistics(PageID pageID, int level, NodeStatistics& leaves,
+                             NodeStatistics& indexes, NodeStatistics& postings, int& height)
+{
+	SortedPage* page = nullptr;
+	PIN(pageID, page);
+
+	int numRecords = page->GetNumOfRecords();
+	Status s = OK;
+	height = max(height, level);
+
+	if (page->GetType() == INDEX_NODE)
+	{
+		BTIndexPage* index = (BTIndexPage *) page;
+		indexes.Add(numRecords, index->Capacity());
+		s = CollectStatistics(index->GetLeftLink(), level + 1, leaves, indexes, postings, height);
+		for (int i = 0; s == OK && i < numRecords; i++)
+		{
+			s = CollectStatistics(index->GetEntry(i).pid, level + 1, leaves, indexes, postings, height);
+		}
+	}
+	else
+	{
+		BTLeafPage* leaf = (BTLeafPage *) page;
+		leaves.Add(numRecords, leaf->Capacity());
+		for (int i = 0; i < numRecords; i++)
+		{
+			RecordID dataRid = leaf->GetEntry(i).rid;
+			BTPostingPage* posting;
+			PageID pid, nextPid;
+
+			for (pid = IsPostingList(dataRid) ? dataRid.pageNo : INVALID_PAGE; pid != INVALID_PAGE; pid = nextPid)
+			{
+				PIN(pid, posting);
+				postings.Add(posting->GetNumOfRecords(), POSTING_CAPACITY);
+				nextPid = posting->GetNextPage();
+				UNPIN(pid, CLEAN);
+			}
+		}
+	}
+
+	UNPIN(pageID, CLEAN);
+	return s;
+}
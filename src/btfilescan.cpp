@@ -17,6 +17,8 @@ BTreeFileScan::~BTreeFileScan()
 {
     setPid(INVALID_PAGE);
     flag = "";
+    if (snapshot != nullptr)
+        btf->snapshots.Close(snapshot);
 }
 
 
@@ -28,6 +30,15 @@ BTreeFileScan::~BTreeFileScan()
 //           key  - key of the scanned record
 // Purpose : Return the next record from the B+-tree index.
 // Return  : OK if successful, DONE if no more records to read.
+// Note    : The record ids of a key with a posting list are read from
+//           the list in place, one page at a time.  A snapshot scan
+//           reads copies of the pages and holds no latch of the tree.
+//           A live scan of a thread-safe tree shares the tree with
+//           other readers and writers.  It latches the leaf it reads,
+//           which keeps the leaf's posting lists as they are too, and
+//           the next leaf before it lets go of the last one.  It first
+//           finds its place again if its pages changed since the last
+//           call.
 //-------------------------------------------------------------------
 
 Status
@@ -35,66 +46,196 @@ BTreeFileScan::GetNext(RecordID& rid, int& key)
 {
 
     BTLeafPage *scanPage;
-    PageID previousPid;
+    BTPostingPage *postPage;
+    PageID previousPid, nextPid;
 	RecordID outRid;
-	Status status;
+    LeafEntry entry;
 
-	if (scanPid == INVALID_PAGE) {
-		return DONE;
-	}
-	PIN(scanPid, (Page *&)scanPage);
-    status = scanPage->GetCurrent(key, outRid, scanRid);
+	EpochGuard epoch(btf->threadSafe);
+	LatchGuard guard((snapshot == nullptr) ? btf->TreeLatch() : nullptr, LATCH_SHARED);
+	BTreeFile::TreePath path;
+	bool latching = (snapshot == nullptr) && btf->threadSafe;
 
+	if (latching)
+		path.StartLatching(&btf->rootLatch, &btf->rootVersion, LATCH_SHARED);
+	for (;;) {
+		if (scanPid == INVALID_PAGE) {
+			return DONE;
+		}
+		path.LatchPage(scanPid);
+		if (!latching || !PagesChanged())
+			break;
+		path.UnlatchAll();
+		if (btf->RepositionScan(this) != OK)
+			return FAIL;
+	}
+	if (ReadPage(scanPid, (Page *&)scanPage, leafCopy) != OK)
+		return FAIL;
 
-    if(flag=="start")
+    // While processing, the scan is on the record id returned last.
+    // Otherwise it is on the next one to return, as the slot of a
+    // deleted entry holds the one after it.
+    if (flag == "processing")
     {
-        if(status==DONE)
-        {
-            return DONE;
-        }
-        flag = "processing";
+        if (postPid != INVALID_PAGE)
+            postSlot++;
+        else
+            scanRid.slotNo++;
     }
-    else if(flag != "delete")
+    flag = "processing";
+
+    while (true)
     {
-        if(status==DONE)
+        if (postPid != INVALID_PAGE)
         {
-            return DONE;
+            if (ReadPage(postPid, (Page *&)postPage, postCopy) != OK)
+                return FAIL;
+            if (postSlot < postPage->GetNumOfRecords())
+            {
+                outRid = postPage->GetRid(postSlot);
+                if (DoneWithPage(postPid) != OK)
+                    return FAIL;
+                key = scanPage->GetKey(scanRid.slotNo);
+                break;
+            }
+
+            // Past the end of this page, and maybe of the list.
+            nextPid = postPage->GetNextPage();
+            if (DoneWithPage(postPid) != OK)
+                return FAIL;
+            postPid = nextPid;
+            postSlot = 0;
+            if (postPid == INVALID_PAGE)
+                scanRid.slotNo++;
+            continue;
         }
-        status = scanPage->GetNext(key, outRid, scanRid);
-    }
 
-	if (status == DONE) {
+        if (scanRid.slotNo >= scanPage->GetNumOfRecords())
+        {
+            previousPid = scanPid;
+            setPid(scanPage->GetNextPage());
+            if (DoneWithPage(previousPid) != OK)
+                return FAIL;
 
-        previousPid = scanPid;
-        setPid(scanPage->GetNextPage());
+            if (scanPid == INVALID_PAGE)
+                return DONE;
 
-		if (scanPid == INVALID_PAGE) {
-            UNPIN(previousPid, CLEAN);
+            path.LatchPage(scanPid);
+            path.UnlatchPage(previousPid);
+            if (ReadPage(scanPid, (Page *&)scanPage, leafCopy) != OK)
+                return FAIL;
+            scanRid.pageNo = scanPid;
+            scanRid.slotNo = 0;
+            continue;
+        }
 
-			return DONE;
-		}
-        else
+        entry = scanPage->GetEntry(scanRid.slotNo);
+        if (IsPostingList(entry.rid))
         {
-			PIN(scanPid, (Page *&)scanPage);
-			status = scanPage->GetFirst(key, outRid, scanRid);
-            UNPIN(previousPid, CLEAN);
-		}
-	}
-    UNPIN(scanPid, CLEAN);
+            postPid = entry.rid.pageNo;
+            postSlot = 0;
+            continue;
+        }
+        key = entry.key;
+        outRid = entry.rid;
+        break;
+    }
+    if (DoneWithPage(scanPid) != OK)
+        return FAIL;
+    RememberPages();
 
-	if ((highKey == nullptr) || (key <= *highKey)) {
+    if ((highKey == nullptr) || (key <= *highKey)) {
 
         rid = outRid;
         currentKey = key;
         currentRid = outRid;
-		return status;
+		return OK;
 	}
     else
     {
 		return DONE;
 	}
+}
 
-    return status;
+
+//-------------------------------------------------------------------
+// BTreeFileScan::ReadPage
+//
+// Input   : pid - a leaf or posting page to read.
+//           copy - where a snapshot scan keeps its copy of such pages.
+// Output  : page - the page, to be given back with DoneWithPage.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Pin the page, or for a snapshot scan, read it as of the
+//           snapshot unless it is the page already copied.
+//-------------------------------------------------------------------
+
+Status BTreeFileScan::ReadPage(PageID pid, Page*& page, PageCopy& copy)
+{
+    if (snapshot == nullptr)
+    {
+        PIN(pid, page);
+        return OK;
+    }
+
+    if (copy.pid != pid)
+    {
+        copy.pid = INVALID_PAGE;
+        if (snapshot->Read(pid, copy.page) != OK)
+            return FAIL;
+        copy.pid = pid;
+    }
+    page = &copy.page;
+    return OK;
+}
+
+
+//-------------------------------------------------------------------
+// BTreeFileScan::DoneWithPage
+//
+// Input   : pid - a page got from ReadPage.
+// Output  : None
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Unpin the page, unless it is a snapshot's copy.
+//-------------------------------------------------------------------
+
+Status BTreeFileScan::DoneWithPage(PageID pid)
+{
+    if (snapshot == nullptr)
+    {
+        UNPIN(pid, CLEAN);
+    }
+    return OK;
+}
+
+
+//-------------------------------------------------------------------
+// BTreeFileScan::RememberPages, BTreeFileScan::PagesChanged
+//
+// Input   : None
+// Output  : None
+// Return  : For PagesChanged, true if the leaf or posting page the
+//           scan is on may have changed since RememberPages.
+// Note    : Called with the scan's leaf latched, or the leaf before it
+//           if the scan is at the start of a leaf, so no writer changes
+//           or frees what the scan is on meanwhile.  The versions are
+//           peeked at, as a writer of a page sharing the version may
+//           wait for the latch.  A page that was freed, or freed and
+//           used again, has moved on too.
+//-------------------------------------------------------------------
+
+void BTreeFileScan::RememberPages()
+{
+    if (scanPid != INVALID_PAGE)
+        leafVersion = PageVersions::Of(scanPid).Peek();
+    if (postPid != INVALID_PAGE)
+        postVersion = PageVersions::Of(postPid).Peek();
+}
+
+bool BTreeFileScan::PagesChanged() const
+{
+    if ((scanPid != INVALID_PAGE) && !PageVersions::Of(scanPid).Validate(leafVersion))
+        return true;
+    return (postPid != INVALID_PAGE) && !PageVersions::Of(postPid).Validate(postVersion);
 }
 
 
@@ -106,15 +247,88 @@ BTreeFileScan::GetNext(RecordID& rid, int& key)
 // Purpose : Delete the entry currently being scanned (i.e. returned
 //           by previous call of GetNext())
 // Return  : OK if successful, DONE if no more record to read.
+// Note    : A snapshot scan deletes the entry from the tree, but
+//           still sees it in the snapshot.
 //-------------------------------------------------------------------
 
 
 Status
 BTreeFileScan::DeleteCurrent()
 {
-    RecordID outRid;
-    Status status;
-    flag = "delete";
-    status = btf->Delete(currentKey, currentRid);
-    return status;
+    return btf->Delete(currentKey, currentRid, this);
+}
+
+
+//-------------------------------------------------------------------
+// BTreeFileScan::EntryInserted
+//
+// Input   : slotNo - where an entry was inserted on the scan's leaf.
+//           key - the key of the entry.
+// Output  : None
+// Purpose : Shift the scan's slot so that it keeps its place.
+// Note    : While processing, the slot holds the entry returned last;
+//           otherwise it holds the next one to return.  A new entry
+//           ahead of that stays ahead of the scan, unless it is below
+//           the low key of a scan that has not started.  Inside a
+//           posting list, the scan has passed the entry at its slot.
+//-------------------------------------------------------------------
+
+void BTreeFileScan::EntryInserted(int slotNo, int key)
+{
+    if ((slotNo < scanRid.slotNo)
+        || ((slotNo == scanRid.slotNo) && ((flag == "processing") || (postPid != INVALID_PAGE)))
+        || ((slotNo == scanRid.slotNo) && (flag == "start")
+            && (lowKey != nullptr) && (key < *lowKey)))
+        scanRid.slotNo++;
+}
+
+
+//-------------------------------------------------------------------
+// BTreeFileScan::EntryDeleted
+//
+// Input   : slotNo - where an entry was deleted on the scan's leaf.
+// Output  : None
+// Purpose : Shift the scan's slot so that it keeps its place.
+// Note    : Deleting the entry returned last leaves the slot on the
+//           next one, as DeleteCurrent does.
+//-------------------------------------------------------------------
+
+void BTreeFileScan::EntryDeleted(int slotNo)
+{
+    if (slotNo < scanRid.slotNo)
+        scanRid.slotNo--;
+    else if ((slotNo == scanRid.slotNo) && (flag == "processing"))
+        flag = "delete";
+}
+
+
+//-------------------------------------------------------------------
+// BTreeFileScan::RidDeleted
+//
+// Input   : slotNo - the entry of the scan's leaf that lost a record id.
+//           change - where the record id was in its posting list.
+// Output  : None
+// Purpose : Shift the scan's place in the posting list so that it
+//           keeps it, as EntryDeleted does on the leaf.
+// Note    : If the page was freed, the scan moves on to the next page,
+//           or past the entry if it was the last one.
+//-------------------------------------------------------------------
+
+void BTreeFileScan::RidDeleted(int slotNo, const PostingChange& change)
+{
+    if ((slotNo != scanRid.slotNo) || (change.pid != postPid))
+        return;
+
+    if (change.slotNo < postSlot)
+        postSlot--;
+    else if ((change.slotNo == postSlot) && (flag == "processing"))
+        flag = "delete";
+
+    if (change.freed)
+    {
+        postPid = change.nextPid;
+        postSlot = 0;
+        if (postPid == INVALID_PAGE)
+            scanRid.slotNo++;
+    }
 }
@@ -15,17 +15,27 @@
 Status
 BTIndexPage::Insert(const int key, const PageID pageID, RecordID& rid)
 {
-	IndexEntry entry;
-	entry.key = key;
-	entry.pid = pageID;
+	ConvertToDense();
 
-	Status s = SortedPage::InsertRecord((char *)&entry, sizeof(IndexEntry), rid);
-	if (s != OK)
+	if (numOfSlots >= INDEX_DENSE_CAPACITY)
 	{
 		cerr << "Fail to insert record into IndexPage" << endl;
 		return FAIL;
 	}
 
+	int pos = UpperBound(key);
+	int *keys = DenseKeys();
+	PageID *pids = DensePids();
+
+	memmove(keys + pos + 1, keys + pos, (numOfSlots - pos) * sizeof(int));
+	memmove(pids + pos + 1, pids + pos, (numOfSlots - pos) * sizeof(PageID));
+	keys[pos] = key;
+	pids[pos] = pageID;
+	numOfSlots++;
+
+	rid.pageNo = PageNo();
+	rid.slotNo = pos;
+
 	return OK;
 }
 
@@ -43,21 +53,25 @@ BTIndexPage::Insert(const int key, const PageID pageID, RecordID& rid)
 Status
 BTIndexPage::Delete (const int key, RecordID& rid)
 {
-	// Scan through all the records in this page and find the
-	// matching pair (key, dataRid).
+	// The last entry not greater than key is the one to delete, if
+	// its key matches.
 
-	for (int i = numOfSlots - 1; i >= 0; i--)
+	ConvertToDense();
+
+	int i = UpperBound(key) - 1;
+	int *keys = DenseKeys();
+	PageID *pids = DensePids();
+
+	if ((i >= 0) && (keys[i] == key))
 	{
-		IndexEntry* entry = (IndexEntry *)(data + slots[i].offset);
-		if (entry->key == key)
-		{
-			// We delete it here.
-			rid.pageNo = PageNo();
-			rid.slotNo = i;
-			Status s = SortedPage::DeleteRecord(rid);
-            // printf("after delete %d, has num of slots %d\n", key, numOfSlots);
-			return s;
-		}
+		// We delete it here.
+		memmove(keys + i, keys + i + 1, (numOfSlots - i - 1) * sizeof(int));
+		memmove(pids + i, pids + i + 1, (numOfSlots - i - 1) * sizeof(PageID));
+		numOfSlots--;
+
+		rid.pageNo = PageNo();
+		rid.slotNo = i;
+		return OK;
 	}
 
 	return FAIL;
@@ -76,19 +90,14 @@ BTIndexPage::Delete (const int key, RecordID& rid)
 
 Status BTIndexPage::Search (int key, PageID& pid, int& outKey)
 {
-	// Scan through all the records in this page and find the
-	// matching pair (key, dataRid).
+	int i = UpperBound(key) - 1;
 
-	for (int i = numOfSlots - 1; i >= 0; i--)
+	if (i >= 0)
 	{
-		IndexEntry* entry = (IndexEntry *)(data + slots[i].offset);
-		if (entry->key <= key)
-		{
-			// We delete it here.
-			pid = entry->pid;
-            outKey = entry->key;
-			return OK;
-		}
+		IndexEntry entry = GetEntry(i);
+		pid = entry.pid;
+		outKey = entry.key;
+		return OK;
 	}
 
     return DONE;
@@ -108,15 +117,14 @@ Status BTIndexPage::Search (int key, PageID& pid, int& outKey)
 Status BTIndexPage::leftSearch (int key, PageID& pid, int& outKey)
 {
 
-	for (int i = 0; i <= numOfSlots - 1; i++)
+	int i = UpperBound(key);
+
+	if (i < numOfSlots)
 	{
-		IndexEntry* entry = (IndexEntry *)(data + slots[i].offset);
-		if (entry->key > key)
-		{
-			pid = entry->pid;
-            outKey = entry->key;
-			return OK;
-		}
+		IndexEntry entry = GetEntry(i);
+		pid = entry.pid;
+		outKey = entry.key;
+		return OK;
 	}
 
     return DONE;
@@ -135,15 +143,13 @@ Status BTIndexPage::leftSearch (int key, PageID& pid, int& outKey)
 
 Status BTIndexPage::changeKey (const int newKey, const int targetKey)
 {
-    for (int i = numOfSlots -1; i >= 0; i--) {
+    ConvertToDense();
 
-        IndexEntry* entry = (IndexEntry *)(data + slots[i].offset);
+    int i = UpperBound(targetKey) - 1;
 
-        if (targetKey == entry->key) {
-            entry->key = newKey;
-			memcpy(data+slots[i].offset, entry, sizeof(IndexEntry));
-			return OK;
-        }
+    if ((i >= 0) && (DenseKeys()[i] == targetKey)) {
+        DenseKeys()[i] = newKey;
+        return OK;
     }
     return FAIL;
 }
@@ -182,12 +188,9 @@ BTIndexPage::GetFirst(int& firstKey, PageID& firstPid, RecordID& rid)
 	}
 
 	// Otherwise, we just copy the record into key and dataRid,
-	// and returned.  The record is located at offset slots[0].offset
-	// from the beginning of data area (pointed to by member data in
-	// HeapPage)
+	// and returned.  GetEntry reads it in either node format.
 
-	IndexEntry entry;
-	memcpy(&entry, (IndexEntry *)(data + slots[0].offset), sizeof(IndexEntry));
+	IndexEntry entry = GetEntry(0);
 	firstKey = entry.key;
 	firstPid = entry.pid;
 
@@ -221,8 +224,7 @@ BTIndexPage::GetLast(int& lastKey, PageID& lastPid, RecordID& rid)
 		return DONE;
 	}
 
-	IndexEntry entry;
-	memcpy(&entry, (IndexEntry *)(data + slots[rid.slotNo].offset), sizeof(IndexEntry));
+	IndexEntry entry = GetEntry(rid.slotNo);
 	lastKey = entry.key;
 	lastPid = entry.pid;
 
@@ -262,12 +264,9 @@ BTIndexPage::GetNext(int& nextKey, PageID& nextPid, RecordID& rid)
 	rid.slotNo++;
 
 	// Otherwise, we just copy the record into key and dataRid,
-	// and returned.  The record is located at offset
-	// slots[rid.slotNo].offset from the beginning of data area
-	// (pointed to by member data in HeapPage)
+	// and returned.  GetEntry reads it in either node format.
 
-	IndexEntry entry;
-	memcpy(&entry, (IndexEntry *)(data + slots[rid.slotNo].offset), sizeof(IndexEntry));
+	IndexEntry entry = GetEntry(rid.slotNo);
 	nextKey = entry.key;
 	nextPid = entry.pid;
 
@@ -304,30 +303,108 @@ void BTIndexPage::SetLeftLink(PageID pageID)
 }
 
 //-------------------------------------------------------------------
-// BTIndexPage::GetLeftLink
+// BTIndexPage::GetRightLink
 //
 // Input   : None
 // Output  : None
-// Purpose : Return the page id of the page at the left of this page.
-// Return  : The page id of the page at the left of this page.
+// Purpose : Return the page id of the right sibling of this page.
+// Return  : The new page of a pending split of this page, and
+//           INVALID_PAGE when there is none.
 //-------------------------------------------------------------------
 
-PageID BTIndexPage::GetParentLink()
+PageID BTIndexPage::GetRightLink()
 {
 	return GetNextPage();
 }
 
 
 //-------------------------------------------------------------------
-// BTIndexPage::SetLeftLink
+// BTIndexPage::SetRightLink
 //
-// Input   : pageID - new left link
+// Input   : pageID - new right link
 // Output  : None
-// Purpose : Set the page id of the page at the left of this page.
+// Purpose : Set the page id of the right sibling of this page.
 // Return  : None
 //-------------------------------------------------------------------
 
-void BTIndexPage::SetParentLink(PageID pageID)
+void BTIndexPage::SetRightLink(PageID pageID)
 {
 	SetNextPage(pageID);
 }
+
+
+//-------------------------------------------------------------------
+// BTIndexPage::GetEntry
+//
+// Input   : slotNo - the position of an entry on this page.
+// Output  : None
+// Purpose : Read the pair (key, pid) at slotNo in either node format.
+// Return  : A copy of the entry.
+//-------------------------------------------------------------------
+
+IndexEntry BTIndexPage::GetEntry(int slotNo)
+{
+	IndexEntry entry;
+
+	if (GetFormat() == DENSE_FORMAT)
+	{
+		entry.key = DenseKeys()[slotNo];
+		entry.pid = DensePids()[slotNo];
+	}
+	else
+	{
+		memcpy(&entry, data + slots[slotNo].offset, sizeof(IndexEntry));
+	}
+
+	return entry;
+}
+
+
+//-------------------------------------------------------------------
+// BTIndexPage::ConvertToDense
+//
+// Input   : None
+// Output  : None
+// Purpose : Rewrite a slotted index page in the dense format, keeping
+//           the order of its entries.  A dense page is left as it is.
+// Note    : Every update goes through here first, so pages of older
+//           files stay readable and are upgraded when written.
+//-------------------------------------------------------------------
+
+void BTIndexPage::ConvertToDense()
+{
+	IndexEntry entries[INDEX_DENSE_CAPACITY];
+	int count = numOfSlots;
+
+	if (GetFormat() == DENSE_FORMAT)
+		return;
+
+	for (int i = 0; i < count; i++)
+		entries[i] = GetEntry(i);
+
+	SetFormat(DENSE_FORMAT);
+	for (int i = 0; i < count; i++)
+	{
+		DenseKeys()[i] = entries[i].key;
+		DensePids()[i] = entries[i].pid;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// BTIndexPage::MoveUpperTo
+//
+// Input   : dst - an empty index page.
+//           keep - the number of entries this page keeps, at least
+//                  one and fewer than it holds.
+// Output  : None
+// Purpose : Move the entries above the first keep of this page to dst.
+// Return  : The first key moved, i.e. the lowest key of dst.
+// Note    : This page is converted to the dense format first.
+//-------------------------------------------------------------------
+
+int BTIndexPage::MoveUpperTo(BTIndexPage& dst, int keep)
+{
+	ConvertToDense();
+	return SortedPage::MoveUpperTo(dst, keep, INDEX_DENSE_CAPACITY, sizeof(PageID));
+}
@@ -10,23 +10,49 @@
 // Output  : pairRid - record id of the inserted pair (key, dataRid)
 // Purpose : Insert the pair (key, dataRid) into this leaf node.
 // Return  : OK if insertion is successful.  FAIL otherwise.
+// Note    : A dense leaf that still has room is updated in place.
+//           Otherwise the entries are written back packed.
 //-------------------------------------------------------------------
 
 Status
 BTLeafPage::Insert(const int key, const RecordID dataRid, RecordID& pairRid)
 {
-	LeafEntry entry;
-	entry.key = key;
-	entry.rid = dataRid;
+	ConvertToDense();
+
+	// Entries with an equal key stay ahead of the new one.
+	int pos = UpperBound(key);
+	pairRid.pageNo = PageNo();
+	pairRid.slotNo = pos;
+
+	if ((GetFormat() == DENSE_FORMAT) && (numOfSlots < LEAF_DENSE_CAPACITY))
+	{
+		int *keys = DenseKeys();
+		RecordID *rids = DenseRids();
+
+		memmove(keys + pos + 1, keys + pos, (numOfSlots - pos) * sizeof(int));
+		memmove(rids + pos + 1, rids + pos, (numOfSlots - pos) * sizeof(RecordID));
+		keys[pos] = key;
+		rids[pos] = dataRid;
+		numOfSlots++;
+		return OK;
+	}
+
+	int keys[LEAF_PACKED_CAPACITY + 1];
+	RecordID rids[LEAF_PACKED_CAPACITY + 1];
+	int count = ReadEntries(keys, rids);
 
-	Status s = SortedPage::InsertRecord((char *)&entry, sizeof(LeafEntry), pairRid);
-	if (s != OK)
+	memmove(keys + pos + 1, keys + pos, (count - pos) * sizeof(int));
+	memmove(rids + pos + 1, rids + pos, (count - pos) * sizeof(RecordID));
+	keys[pos] = key;
+	rids[pos] = dataRid;
+
+	if (!Fits(keys, rids, count + 1))
 	{
 		cerr << "Fail to insert record into LeafPage" << endl;
 		return FAIL;
 	}
 
-	return OK;
+	return WriteEntries(keys, rids, count + 1);
 }
 
 //-------------------------------------------------------------------
@@ -43,19 +69,27 @@ BTLeafPage::Insert(const int key, const RecordID dataRid, RecordID& pairRid)
 Status
 BTLeafPage::Delete(const int key, const RecordID dataRid, RecordID& rid)
 {
-	// Scan through all the records in this page and find the
-	// matching pair (key, dataRid).
+	// Only the run of entries with this key can hold the matching
+	// pair (key, dataRid).
 
-	for (int i = numOfSlots - 1; i >= 0; i--)
+	ConvertToDense();
+
+	int first = LowerBound(key);
+	int keys[LEAF_PACKED_CAPACITY];
+	RecordID rids[LEAF_PACKED_CAPACITY];
+	int count = ReadEntries(keys, rids);
+
+	for (int i = UpperBound(key) - 1; i >= first; i--)
 	{
-		LeafEntry* entry = GetEntry(i);
-		if (entry->rid == dataRid && entry->key == key)
+		if (rids[i] == dataRid)
 		{
-			// We delete it here.
+			// We delete it here, and write back what is left.
+			memmove(keys + i, keys + i + 1, (count - i - 1) * sizeof(int));
+			memmove(rids + i, rids + i + 1, (count - i - 1) * sizeof(RecordID));
+
 			rid.pageNo = PageNo();
 			rid.slotNo = i;
-			Status s = SortedPage::DeleteRecord(rid);
-			return s;
+			return WriteEntries(keys, rids, count - 1);
 		}
 	}
 
@@ -98,12 +132,9 @@ BTLeafPage::GetFirst(int& key, RecordID& dataRid, RecordID& rid)
 	}
 
 	// Otherwise, we just copy the record into key and dataRid,
-	// and returned.  The record is located at offset slots[0].offset
-	// from the beginning of data area (pointed to by member data in
-	// HeapPage)
+	// and returned.  GetEntry reads it in either node format.
 
-	LeafEntry entry;
-	memcpy(&entry, GetEntry(0), sizeof(LeafEntry));
+	LeafEntry entry = GetEntry(0);
 	key = entry.key;
 	dataRid = entry.rid;
 
@@ -135,8 +166,7 @@ Status BTLeafPage::GetLast (int& key, RecordID& dataRid, RecordID& rid)
 		return DONE;
 	}
 
-    LeafEntry entry;
-	memcpy(&entry, GetEntry(rid.slotNo), sizeof(LeafEntry));
+    LeafEntry entry = GetEntry(rid.slotNo);
 	key = entry.key;
 	dataRid = entry.rid;
 
@@ -168,8 +198,7 @@ Status BTLeafPage::GetHalf (int& key, RecordID& dataRid, RecordID& rid)
 		return DONE;
 	}
 
-    LeafEntry entry;
-	memcpy(&entry, GetEntry(rid.slotNo), sizeof(LeafEntry));
+    LeafEntry entry = GetEntry(rid.slotNo);
 	key = entry.key;
 	dataRid = entry.rid;
 
@@ -210,12 +239,9 @@ BTLeafPage::GetNext(int& key, RecordID& dataRid, RecordID& rid)
 	rid.slotNo++;
 
 	// Otherwise, we just copy the record into key and dataRid,
-	// and returned.  The record is located at offset
-	// slots[rid.slotNo].offset from the beginning of data area
-	// (pointed to by member data in HeapPage)
+	// and returned.  GetEntry reads it in either node format.
 
-	LeafEntry entry;
-	memcpy(&entry, GetEntry(rid.slotNo), sizeof(LeafEntry));
+	LeafEntry entry = GetEntry(rid.slotNo);
 	key = entry.key;
 	dataRid = entry.rid;
 
@@ -250,14 +276,521 @@ BTLeafPage::GetCurrent(int& key, RecordID& dataRid, RecordID rid)
 	}
 
 	// If it's valid, we just copy the record into key and dataRid,
-	// and returned.  The record is located at offset
-	// slots[rid.slotNo].offset from the beginning of data area
-	// (pointed to by member data in HeapPage)
+	// and returned.  GetEntry reads it in either node format.
 
-	LeafEntry entry;
-	memcpy(&entry, GetEntry(rid.slotNo), sizeof(LeafEntry));
+	LeafEntry entry = GetEntry(rid.slotNo);
 	key = entry.key;
 	dataRid = entry.rid;
 
 	return OK;
 }
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::SetDataRid
+//
+// Input   : slotNo - the position of an entry on this page.
+//           dataRid - the new record id of the entry.
+// Output  : None
+// Purpose : Replace the record id of an entry, keeping its key.
+// Return  : OK if successful, FAIL if there is no such entry or the
+//           entries no longer fit once it is replaced.
+//-------------------------------------------------------------------
+
+Status BTLeafPage::SetDataRid(int slotNo, const RecordID dataRid)
+{
+	if (slotNo < 0 || slotNo >= numOfSlots)
+		return FAIL;
+
+	ConvertToDense();
+	if (GetFormat() == DENSE_FORMAT)
+	{
+		DenseRids()[slotNo] = dataRid;
+		return OK;
+	}
+
+	int keys[LEAF_PACKED_CAPACITY];
+	RecordID rids[LEAF_PACKED_CAPACITY];
+	int count = ReadEntries(keys, rids);
+
+	rids[slotNo] = dataRid;
+	if (!Fits(keys, rids, count))
+		return FAIL;
+
+	return WriteEntries(keys, rids, count);
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::CanSetDataRid
+//
+// Input   : slotNo - the position of an entry on this page.
+//           dataRid - a new record id for the entry.
+// Output  : None
+// Purpose : Check that SetDataRid would succeed, before anything that
+//           depends on it is changed.
+// Return  : True if the entries still fit with dataRid in slotNo.
+//-------------------------------------------------------------------
+
+bool BTLeafPage::CanSetDataRid(int slotNo, const RecordID dataRid)
+{
+	if (GetFormat() != PACKED_FORMAT)
+		return true;
+
+	int keys[LEAF_PACKED_CAPACITY];
+	RecordID rids[LEAF_PACKED_CAPACITY];
+	int count = ReadEntries(keys, rids);
+
+	rids[slotNo] = dataRid;
+	return Fits(keys, rids, count);
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::HasRoomFor
+//
+// Input   : key  - value of a key to be inserted.
+//           dataRid - record id of the record associated with key.
+// Output  : None
+// Purpose : Check that Insert would succeed.
+// Return  : True if the entries still fit with (key, dataRid) added.
+//-------------------------------------------------------------------
+
+bool BTLeafPage::HasRoomFor(const int key, const RecordID dataRid)
+{
+	if (GetNumOfRecords() < LEAF_DENSE_CAPACITY)
+		return true;
+
+	int keys[LEAF_PACKED_CAPACITY + 1];
+	RecordID rids[LEAF_PACKED_CAPACITY + 1];
+	int count = ReadEntries(keys, rids);
+	int pos = UpperBound(key);
+
+	memmove(keys + pos + 1, keys + pos, (count - pos) * sizeof(int));
+	memmove(rids + pos + 1, rids + pos, (count - pos) * sizeof(RecordID));
+	keys[pos] = key;
+	rids[pos] = dataRid;
+
+	return Fits(keys, rids, count + 1);
+}
+
+
+//-------------------------------------------------------------------
+// ReadDelta, WriteDelta
+//
+// Read or write one delta of a packed leaf column, width bytes long.
+// Columns are not aligned, so wider deltas are copied bytewise.
+//-------------------------------------------------------------------
+
+static inline unsigned int ReadDelta(const unsigned char *column, int width, int i)
+{
+	unsigned short delta2;
+	unsigned int delta4;
+
+	switch (width)
+	{
+		case 1:
+			return column[i];
+		case 2:
+			memcpy(&delta2, column + 2 * i, 2);
+			return delta2;
+		default:
+			memcpy(&delta4, column + 4 * i, 4);
+			return delta4;
+	}
+}
+
+static inline void WriteDelta(unsigned char *column, int width, int i, unsigned int delta)
+{
+	unsigned short delta2 = (unsigned short)delta;
+
+	switch (width)
+	{
+		case 1:
+			column[i] = (unsigned char)delta;
+			break;
+		case 2:
+			memcpy(column + 2 * i, &delta2, 2);
+			break;
+		default:
+			memcpy(column + 4 * i, &delta, 4);
+			break;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// PackedLayout
+//
+// Input   : keys, rids - entries in key order.
+//           count - the number of entries, at least one.
+// Output  : bases - the lowest key, page number and slot number.
+//           widths - the bytes a delta of each of them takes.
+// Purpose : Work out how the entries are packed.
+//-------------------------------------------------------------------
+
+static void PackedLayout(const int *keys, const RecordID *rids, int count,
+                         int *bases, int *widths)
+{
+	int highPage = rids[0].pageNo, highSlot = rids[0].slotNo;
+
+	bases[0] = keys[0];
+	bases[1] = rids[0].pageNo;
+	bases[2] = rids[0].slotNo;
+	for (int i = 1; i < count; i++)
+	{
+		bases[1] = min(bases[1], rids[i].pageNo);
+		bases[2] = min(bases[2], rids[i].slotNo);
+		highPage = max(highPage, rids[i].pageNo);
+		highSlot = max(highSlot, rids[i].slotNo);
+	}
+
+	int highs[3] = { keys[count - 1], highPage, highSlot };
+	for (int field = 0; field < 3; field++)
+	{
+		unsigned int range = (unsigned int)highs[field] - (unsigned int)bases[field];
+		widths[field] = (range <= 0xff) ? 1 : (range <= 0xffff) ? 2 : 4;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::PackedCapacity
+//
+// Input   : keys, rids - entries in key order.
+//           count - the number of entries, at least one.
+// Output  : None
+// Purpose : Size a packed leaf for these entries.
+// Return  : The number of entries a packed leaf holds with the delta
+//           widths these entries need.
+//-------------------------------------------------------------------
+
+int BTLeafPage::PackedCapacity(const int *keys, const RecordID *rids, int count)
+{
+	int bases[3], widths[3];
+
+	PackedLayout(keys, rids, count, bases, widths);
+	return (DENSE_AREA_SIZE - LEAF_PACKED_HEADER) / (widths[0] + widths[1] + widths[2]);
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::Fits
+//
+// Input   : keys, rids - entries in key order.
+//           count - the number of entries.
+// Output  : None
+// Purpose : Check whether the entries fit on one leaf.
+// Return  : True if they fit dense, or packed if they have to be.
+//-------------------------------------------------------------------
+
+bool BTLeafPage::Fits(const int *keys, const RecordID *rids, int count)
+{
+	return (count <= LEAF_DENSE_CAPACITY)
+		|| ((count <= LEAF_PACKED_CAPACITY) && (count <= PackedCapacity(keys, rids, count)));
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::GetEntry
+//
+// Input   : slotNo - the position of an entry on this page.
+// Output  : None
+// Purpose : Read the pair (key, dataRid) at slotNo in any node
+//           format.
+// Return  : A copy of the entry.
+//-------------------------------------------------------------------
+
+LeafEntry BTLeafPage::GetEntry(int slotNo)
+{
+	LeafEntry entry;
+
+	if (GetFormat() == DENSE_FORMAT)
+	{
+		entry.key = DenseKeys()[slotNo];
+		entry.rid = DenseRids()[slotNo];
+	}
+	else if (GetFormat() == PACKED_FORMAT)
+	{
+		int *bases = PackedBases();
+		entry.key = GetPackedKey(slotNo);
+		entry.rid.pageNo = (int)((unsigned int)bases[1] + ReadDelta(PackedColumn(1), PackedWidth(1), slotNo));
+		entry.rid.slotNo = (int)((unsigned int)bases[2] + ReadDelta(PackedColumn(2), PackedWidth(2), slotNo));
+	}
+	else
+	{
+		memcpy(&entry, data + slots[slotNo].offset, sizeof(LeafEntry));
+	}
+
+	return entry;
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::GetKey, BTLeafPage::LowerBound, BTLeafPage::UpperBound
+//
+// As in SortedPage, which reads dense and slotted leaves.  A packed
+// leaf has its keys decoded, and searched with the current kernel.
+//-------------------------------------------------------------------
+
+int BTLeafPage::GetKey(int slotNo)
+{
+	if (GetFormat() != PACKED_FORMAT)
+		return SortedPage::GetKey(slotNo);
+
+	return GetPackedKey(slotNo);
+}
+
+int BTLeafPage::LowerBound(const int key)
+{
+	int keys[LEAF_PACKED_CAPACITY];
+
+	if (GetFormat() != PACKED_FORMAT)
+		return SortedPage::LowerBound(key);
+
+	DecodeKeys(keys);
+	return GetSearchKernel()->lowerBound(keys, numOfSlots, key);
+}
+
+int BTLeafPage::UpperBound(const int key)
+{
+	int keys[LEAF_PACKED_CAPACITY];
+
+	if (GetFormat() != PACKED_FORMAT)
+		return SortedPage::UpperBound(key);
+
+	DecodeKeys(keys);
+	return GetSearchKernel()->upperBound(keys, numOfSlots, key);
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::GetPackedKey
+//
+// Input   : slotNo - the position of an entry on this packed leaf.
+// Output  : None
+// Purpose : Decode a single key, without its record id.
+// Return  : The key at slotNo.
+//-------------------------------------------------------------------
+
+int BTLeafPage::GetPackedKey(int slotNo)
+{
+	return (int)((unsigned int)PackedBases()[0] + ReadDelta(PackedColumn(0), PackedWidth(0), slotNo));
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::ConvertToDense
+//
+// Input   : None
+// Output  : None
+// Purpose : Rewrite a slotted leaf in the dense format, keeping the
+//           order of its entries.  A dense or packed leaf is left as
+//           it is.
+// Note    : Every update goes through here first, so pages of older
+//           files stay readable and are upgraded when written.
+//-------------------------------------------------------------------
+
+void BTLeafPage::ConvertToDense()
+{
+	LeafEntry entries[LEAF_DENSE_CAPACITY];
+	int count = numOfSlots;
+
+	if (GetFormat() != SLOTTED_FORMAT)
+		return;
+
+	for (int i = 0; i < count; i++)
+		entries[i] = GetEntry(i);
+
+	SetFormat(DENSE_FORMAT);
+	for (int i = 0; i < count; i++)
+	{
+		DenseKeys()[i] = entries[i].key;
+		DenseRids()[i] = entries[i].rid;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::FillCapacity
+//
+// Input   : None
+// Output  : None
+// Purpose : Size the leaf for its fill factor.
+// Return  : The number of entries a packed leaf holds with the delta
+//           widths the entries of this one need.
+// Note    : Capacity() of a dense leaf is the few entries it holds
+//           before it is packed, which would make a leaf look fuller
+//           as it shrinks below that.
+//-------------------------------------------------------------------
+
+int BTLeafPage::FillCapacity()
+{
+	if (GetFormat() != DENSE_FORMAT)
+		return Capacity();
+
+	int keys[LEAF_PACKED_CAPACITY];
+	RecordID rids[LEAF_PACKED_CAPACITY];
+	int count = ReadEntries(keys, rids);
+
+	if (count == 0)
+		return LEAF_PACKED_CAPACITY;
+	return max(LEAF_DENSE_CAPACITY, PackedCapacity(keys, rids, count));
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::ReadEntries
+//
+// Input   : None
+// Output  : keys, rids - the entries of this leaf, in order.  Both
+//                       have room for LEAF_PACKED_CAPACITY entries.
+// Purpose : Decode the entries of a leaf in any node format.
+// Return  : The number of entries.
+//-------------------------------------------------------------------
+
+int BTLeafPage::ReadEntries(int *keys, RecordID *rids)
+{
+	if (GetFormat() == PACKED_FORMAT)
+	{
+		int *bases = PackedBases();
+		const unsigned char *pages = PackedColumn(1), *slotNos = PackedColumn(2);
+		int pageWidth = PackedWidth(1), slotWidth = PackedWidth(2);
+
+		DecodeKeys(keys);
+		for (int i = 0; i < numOfSlots; i++)
+		{
+			rids[i].pageNo = (int)((unsigned int)bases[1] + ReadDelta(pages, pageWidth, i));
+			rids[i].slotNo = (int)((unsigned int)bases[2] + ReadDelta(slotNos, slotWidth, i));
+		}
+		return numOfSlots;
+	}
+
+	for (int i = 0; i < numOfSlots; i++)
+	{
+		LeafEntry entry = GetEntry(i);
+		keys[i] = entry.key;
+		rids[i] = entry.rid;
+	}
+	return numOfSlots;
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::WriteEntries
+//
+// Input   : keys, rids - entries in key order.
+//           count - the number of entries.
+// Output  : None
+// Purpose : Replace the entries of this leaf.  They are written dense
+//           if they fit, and packed otherwise.
+// Return  : OK if successful, FAIL if they do not fit in either.
+//-------------------------------------------------------------------
+
+Status BTLeafPage::WriteEntries(const int *keys, const RecordID *rids, int count)
+{
+	int bases[3], widths[3];
+
+	if (count <= LEAF_DENSE_CAPACITY)
+	{
+		SetFormat(DENSE_FORMAT);
+		memmove(DenseKeys(), keys, count * sizeof(int));
+		memmove(DenseRids(), rids, count * sizeof(RecordID));
+		numOfSlots = count;
+		return OK;
+	}
+
+	if (!Fits(keys, rids, count))
+		return FAIL;
+
+	PackedLayout(keys, rids, count, bases, widths);
+	SetFormat(PACKED_FORMAT);
+	numOfSlots = count;
+	memcpy(PackedBases(), bases, sizeof(bases));
+	*((unsigned char *)DenseKeys() + 3 * sizeof(int)) = (unsigned char)
+		((widths[0] >> 1) | ((widths[1] >> 1) << 2) | ((widths[2] >> 1) << 4));
+
+	unsigned char *columns[3] = { PackedColumn(0), PackedColumn(1), PackedColumn(2) };
+	for (int i = 0; i < count; i++)
+	{
+		WriteDelta(columns[0], widths[0], i, (unsigned int)keys[i] - (unsigned int)bases[0]);
+		WriteDelta(columns[1], widths[1], i, (unsigned int)rids[i].pageNo - (unsigned int)bases[1]);
+		WriteDelta(columns[2], widths[2], i, (unsigned int)rids[i].slotNo - (unsigned int)bases[2]);
+	}
+	return OK;
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::DecodeKeys
+//
+// Input   : None
+// Output  : keys - the keys of this packed leaf.
+// Purpose : Widen the key deltas of a packed leaf into full keys, so
+//           that they can go through the key search kernels.
+// Note    : Each width has its own loop, with no dependencies between
+//           iterations, so that the compiler vectorizes it.
+//-------------------------------------------------------------------
+
+__attribute__((optimize("O2")))
+void BTLeafPage::DecodeKeys(int *keys)
+{
+	const unsigned char *deltas = PackedColumn(0);
+	unsigned int base = PackedBases()[0];
+	unsigned short delta2;
+	unsigned int delta4;
+
+	switch (PackedWidth(0))
+	{
+		case 1:
+			for (int i = 0; i < numOfSlots; i++)
+				keys[i] = (int)(base + deltas[i]);
+			break;
+		case 2:
+			for (int i = 0; i < numOfSlots; i++)
+			{
+				memcpy(&delta2, deltas + 2 * i, 2);
+				keys[i] = (int)(base + delta2);
+			}
+			break;
+		default:
+			for (int i = 0; i < numOfSlots; i++)
+			{
+				memcpy(&delta4, deltas + 4 * i, 4);
+				keys[i] = (int)(base + delta4);
+			}
+			break;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// BTLeafPage::MoveUpperTo
+//
+// Input   : dst - an empty leaf.
+//           keep - the number of entries this leaf keeps, at least
+//                  one and fewer than it holds.
+// Output  : None
+// Purpose : Move the entries above the first keep of this leaf to dst.
+// Return  : The first key moved, i.e. the lowest key of dst.
+// Note    : A packed leaf is decoded and both parts are written back,
+//           each in the format it fits.  Other leaves are made dense
+//           and moved by SortedPage in two block copies.
+//-------------------------------------------------------------------
+
+int BTLeafPage::MoveUpperTo(BTLeafPage& dst, int keep)
+{
+	if (GetFormat() != PACKED_FORMAT)
+	{
+		ConvertToDense();
+		return SortedPage::MoveUpperTo(dst, keep, LEAF_DENSE_CAPACITY, sizeof(RecordID));
+	}
+
+	int keys[LEAF_PACKED_CAPACITY];
+	RecordID rids[LEAF_PACKED_CAPACITY];
+	int count = ReadEntries(keys, rids);
+
+	WriteEntries(keys, rids, keep);
+	dst.WriteEntries(keys + keep, rids + keep, count - keep);
+	return keys[keep];
+}
@@ -0,0 +1,98 @@
+#include <memory.h>
+#include "btposting.h"
+
+
+//-------------------------------------------------------------------
+// BTPostingPage::Insert
+//
+// Input   : rid - the record id to be inserted.
+// Output  : None
+// Purpose : Insert rid into this page, keeping the record ids sorted.
+// Return  : OK if insertion is successful.  FAIL if the page is full.
+//-------------------------------------------------------------------
+
+Status BTPostingPage::Insert(const RecordID rid)
+{
+	if (IsFull())
+	{
+		cerr << "Fail to insert record into PostingPage" << endl;
+		return FAIL;
+	}
+
+	int pos = Find(rid);
+	RecordID *rids = Rids();
+
+	memmove(rids + pos + 1, rids + pos, (numOfSlots - pos) * sizeof(RecordID));
+	rids[pos] = rid;
+	numOfSlots++;
+
+	return OK;
+}
+
+//-------------------------------------------------------------------
+// BTPostingPage::Delete
+//
+// Input   : rid - the record id to be deleted.
+// Output  : slotNo - where rid was on this page.
+// Purpose : Remove rid from this page.
+// Return  : OK if successful, FAIL if rid is not on this page.
+//-------------------------------------------------------------------
+
+Status BTPostingPage::Delete(const RecordID rid, int& slotNo)
+{
+	RecordID *rids = Rids();
+
+	slotNo = Find(rid);
+	if ((slotNo >= numOfSlots) || (rids[slotNo] != rid))
+		return FAIL;
+
+	memmove(rids + slotNo, rids + slotNo + 1, (numOfSlots - slotNo - 1) * sizeof(RecordID));
+	numOfSlots--;
+
+	return OK;
+}
+
+//-------------------------------------------------------------------
+// BTPostingPage::Find
+//
+// Input   : rid - the record id to look for.
+// Output  : None
+// Purpose : Binary search the record ids of this page.
+// Return  : The position of the first record id not less than rid.
+//-------------------------------------------------------------------
+
+int BTPostingPage::Find(const RecordID rid)
+{
+	RecordID *rids = Rids();
+	int low = 0, high = numOfSlots;
+
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (rids[mid] < rid)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+//-------------------------------------------------------------------
+// BTPostingPage::MoveUpperHalfTo
+//
+// Input   : dst - an empty posting page.
+// Output  : None
+// Purpose : Move the upper half of the record ids to dst, as is done
+//           when a posting page is split.
+// Note    : The links between the two pages are left to the caller.
+//-------------------------------------------------------------------
+
+void BTPostingPage::MoveUpperHalfTo(BTPostingPage& dst)
+{
+	int keep = numOfSlots - numOfSlots / 2;
+
+	memcpy(dst.Rids(), Rids() + keep, (numOfSlots - keep) * sizeof(RecordID));
+	dst.numOfSlots = numOfSlots - keep;
+	numOfSlots = keep;
+}
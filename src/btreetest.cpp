@@ -6,11 +6,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include "bufmgr.h"
 #include "db.h"
 #include "btfile.h"
 #include "btreetest.h"
+#include "snapshot.h"
 
 #define MAX_COMMAND_SIZE 1000
 
@@ -43,27 +48,88 @@ Status BTreeTest::RunTests(istream& in) {
 			in >> low >> high;
 			insertHighLow(btf, low, high);
 		} 
+		else if (!strcmp(command, "upsert")) {
+			int low, high;
+			in >> low >> high;
+			upsertHighLow(btf, low, high);
+		}
+		else if (!strcmp(command, "insertifabsent")) {
+			int low, high;
+			in >> low >> high;
+			insertIfAbsentHighLow(btf, low, high);
+		}
+		else if (!strcmp(command, "bulkload")) {
+			int low, high;
+			in >> low >> high;
+			bulkLoadHighLow(btf, low, high);
+		}
+		else if (!strcmp(command, "insertbatch")) {
+			int low, high;
+			in >> low >> high;
+			insertBatchHighLow(btf, low, high);
+		}
 		else if (!strcmp(command, "scan")) {
 			int low, high;
 			in >> low >> high;
 			scanHighLow(btf, low, high);
 		}
+		else if (!strcmp(command, "lookup")) {
+			int low, high;
+			in >> low >> high;
+			lookupHighLow(btf, low, high);
+		}
+		else if (!strcmp(command, "multilookup")) {
+			int low, high;
+			in >> low >> high;
+			multiLookupHighLow(btf, low, high);
+		}
 		else if (!strcmp(command, "delete")) {
 			int low, high;
 			in >> low >> high;
 			deleteHighLow(btf, low, high);
 		}
+		else if (!strcmp(command, "deleterange")) {
+			int low, high;
+			in >> low >> high;
+			deleteRangeHighLow(btf, low, high);
+		}
 		else if (!strcmp(command, "deletescan")) {
 			int low, high;
 			in >> low >> high;
 			deleteScanHighLow(btf, low, high);
 		}
+		else if (!strcmp(command, "searchbench")) {
+			int numKeys, iterations;
+			in >> numKeys >> iterations;
+			searchBenchmark(numKeys, iterations);
+		}
+		else if (!strcmp(command, "threadbench")) {
+			int numKeys, lookups, maxThreads;
+			in >> numKeys >> lookups >> maxThreads;
+			threadBenchmark(numKeys, lookups, maxThreads);
+		}
+		else if (!strcmp(command, "hintscan")) {
+			int numKeys;
+			in >> numKeys;
+			hintScan(numKeys);
+		}
+		else if (!strcmp(command, "snapshotscan")) {
+			int numKeys;
+			in >> numKeys;
+			snapshotScan(numKeys);
+		}
 		else if (!strcmp(command, "print")) {
 			btf->Print();
 		}
 		else if (!strcmp(command, "stats")) {
 			btf->DumpStatistics();
 		}
+		else if (!strcmp(command, "rebalance")) {
+			int mergePercent, redistributePercent;
+			in >> mergePercent >> redistributePercent;
+			if (btf->SetRebalanceThresholds(mergePercent / 100.0f, redistributePercent / 100.0f) != OK)
+				cout << "Error: Invalid rebalance thresholds" << endl;
+		}
 		else if (!strcmp(command, "quit")) {
 			break;
 		}
@@ -138,6 +204,245 @@ void BTreeTest::insertHighLow(BTreeFile* btf, int low, int high) {
 }
 
 
+void BTreeTest::upsertHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Upserting: (" << low << " to " << high << ")" << endl;
+
+	int numKeys = high - low + 1;
+	for (int i = 0; i < numKeys; i++) {
+		RecordID rid;
+		rid.pageNo = i;
+		rid.slotNo = 0;
+
+		int key = low + i;
+		cout << "  Upsert: " << key << " @[pg,slot]=[" << rid.pageNo << "," << rid.slotNo << "]" << endl;
+		if (btf->Upsert(key, rid) != OK) {
+			cout << "  Upsert failed." << endl;
+			minibase_errors.show_errors();
+			return;
+		}
+	}
+	cout << "  Success." << endl;
+}
+
+
+// Insert every key in [low, high] unless it is there already, first
+// into btf and then into new trees, in the default and the thread-safe
+// mode, that hold every other key, some of them three times over.
+void BTreeTest::insertIfAbsentHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Inserting if absent: (" << low << " to " << high << ")" << endl;
+
+	int numInserted, numKept;
+	if (!insertIfAbsentChecked(btf, low, high, numInserted, numKept)) {
+		return;
+	}
+	cout << "  " << numInserted << " records inserted, " << numKept << " keys already present." << endl;
+
+	const char* name = "InsertIfAbsentIndex";
+	for (int threadSafe = 0; threadSafe < 2; threadSafe++) {
+		Status status;
+		BTreeFile* newBtf = new BTreeFile(status, name, threadSafe != 0);
+		if (status != OK) {
+			minibase_errors.show_errors();
+			cout << "  Error: cannot open index file." << endl;
+			delete newBtf;
+			return;
+		}
+		for (int key = low; (status == OK) && (key <= high); key += 2) {
+			int copies = ((key - low) % 4 == 0) ? 3 : 1;
+			for (int copy = 0; (status == OK) && (copy < copies); copy++) {
+				RecordID rid;
+				rid.pageNo = key - low;
+				rid.slotNo = copy + 1;
+				status = newBtf->Insert(key, rid);
+			}
+		}
+		bool checked = (status == OK) && insertIfAbsentChecked(newBtf, low, high, numInserted, numKept);
+		if (status != OK) {
+			cout << "  Insertion failed." << endl;
+			minibase_errors.show_errors();
+		}
+		newBtf->DestroyFile();
+		delete newBtf;
+		if (!checked) {
+			return;
+		}
+		if (numKept != (high - low) / 2 + 1) {
+			cout << "  Error: " << numKept << " keys found present." << endl;
+			return;
+		}
+		cout << "  " << numInserted << " records inserted, " << numKept << " keys already present";
+		cout << (threadSafe ? " in a new thread-safe tree." : " in a new tree.") << endl;
+	}
+	cout << "  Success." << endl;
+}
+
+
+// Insert every key in [low, high] unless it is there already, and check
+// that a key found before keeps exactly its record ids, and a key not
+// found gets the new one only.
+bool BTreeTest::insertIfAbsentChecked(BTreeFile* btf, int low, int high, int& numInserted, int& numKept) {
+	const int maxRids = 16;
+	RecordID before[maxRids], after[maxRids];
+	int numBefore, numAfter;
+
+	numInserted = numKept = 0;
+	for (int key = low; key <= high; key++) {
+		RecordID rid;
+		rid.pageNo = key - low;
+		rid.slotNo = 0;
+
+		Status found = btf->Lookup(key, before, maxRids, numBefore);
+		Status status = btf->InsertIfAbsent(key, rid);
+		if (found == FAIL || status == FAIL || btf->Lookup(key, after, maxRids, numAfter) != OK) {
+			cout << "  Error: insertion or lookup of " << key << " failed." << endl;
+			minibase_errors.show_errors();
+			return false;
+		}
+
+		bool same;
+		if (found == OK) {
+			same = (status == DONE) && (numAfter == numBefore);
+			for (int i = 0; same && (i < numAfter); i++) {
+				same = (after[i].pageNo == before[i].pageNo) && (after[i].slotNo == before[i].slotNo);
+			}
+			numKept++;
+		}
+		else {
+			same = (status == OK) && (numAfter == 1) && (after[0].pageNo == rid.pageNo) && (after[0].slotNo == rid.slotNo);
+			numInserted++;
+		}
+		if (!same) {
+			cout << "  Error: key " << key << " has the wrong records after the insertion." << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+void BTreeTest::bulkLoadHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Bulk loading: (" << low << " to " << high << ")" << endl;
+
+	int numKeys = high - low + 1;
+	vector<LeafEntry> entries(numKeys);
+	for (int i = 0; i < numKeys; i++) {
+		entries[i].key = low + i;
+		entries[i].rid.pageNo = i;
+		entries[i].rid.slotNo = i + 1;
+	}
+
+	if (btf->BulkLoad(entries.data(), numKeys) != OK) {
+		cout << "  Bulk load failed." << endl;
+		minibase_errors.show_errors();
+		return;
+	}
+	cout << "  " << numKeys << " records loaded." << endl;
+	cout << "  Success." << endl;
+}
+
+
+// Insert every key in [low, high] twice, with different rids, as one
+// batch in descending order, first into btf and then into a new empty
+// tree in thread-safe mode.
+void BTreeTest::insertBatchHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Batch inserting: (" << low << " to " << high << ")" << endl;
+
+	if (high < low) {
+		cout << "  Error: empty batch." << endl;
+		return;
+	}
+
+	int numKeys = high - low + 1;
+	vector<LeafEntry> entries(2 * numKeys);
+	for (int i = 0; i < numKeys; i++) {
+		for (int copy = 0; copy < 2; copy++) {
+			LeafEntry& entry = entries[copy * numKeys + i];
+			entry.key = high - i;
+			entry.rid.pageNo = numKeys - 1 - i;
+			entry.rid.slotNo = numKeys - i + copy;
+		}
+	}
+
+	if (!insertBatchChecked(btf, low, high, entries)) {
+		return;
+	}
+	cout << "  " << entries.size() << " records inserted." << endl;
+
+	const char* name = "InsertBatchIndex";
+	Status status;
+	BTreeFile* safeBtf = new BTreeFile(status, name, true);
+	if (status != OK) {
+		minibase_errors.show_errors();
+		cout << "  Error: cannot open index file." << endl;
+		delete safeBtf;
+		return;
+	}
+	bool inserted = insertBatchChecked(safeBtf, low, high, entries);
+	safeBtf->DestroyFile();
+	delete safeBtf;
+	if (inserted) {
+		cout << "  " << entries.size() << " records inserted into a thread-safe tree." << endl;
+		cout << "  Success." << endl;
+	}
+}
+
+
+// Insert entries, all with keys in [low, high], as one batch, and check
+// that a scan of [low, high] then finds them all, in key order.
+bool BTreeTest::insertBatchChecked(BTreeFile* btf, int low, int high, const vector<LeafEntry>& entries) {
+	int before, after;
+	if (!countScanned(btf, low, high, before)) {
+		return false;
+	}
+	if (btf->InsertBatch(entries.data(), entries.size()) != OK) {
+		cout << "  Error: batch insertion failed." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+	if (!countScanned(btf, low, high, after)) {
+		return false;
+	}
+	if (after - before != (int)entries.size()) {
+		cout << "  Error: " << after - before << " of " << entries.size() << " records found." << endl;
+		return false;
+	}
+	return true;
+}
+
+
+// Count the entries a scan of [low, high] returns, and check that their
+// keys are in range and ascending.
+bool BTreeTest::countScanned(BTreeFile* btf, int low, int high, int& count) {
+	IndexFileScan* scan = btf->OpenScan(&low, &high);
+	if (scan == nullptr) {
+		cout << "  Error: cannot open a scan." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+
+	RecordID rid;
+	int ikey, prevKey = low;
+	Status status;
+	count = 0;
+	while ((status = scan->GetNext(rid, ikey)) == OK) {
+		if (ikey < prevKey || ikey > high) {
+			cout << "  Error: key " << ikey << " scanned after " << prevKey << "." << endl;
+			delete scan;
+			return false;
+		}
+		prevKey = ikey;
+		count++;
+	}
+	delete scan;
+	if (status != DONE) {
+		cout << "  Error: scan failed." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+	return true;
+}
+
+
 void BTreeTest::scanHighLow(BTreeFile* btf, int low, int high) {
 	cout << "Scanning (" << low << " to " << high << "):" << endl;
 
@@ -171,6 +476,66 @@ void BTreeTest::scanHighLow(BTreeFile* btf, int low, int high) {
 }
 
 
+void BTreeTest::lookupHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Looking up (" << low << " to " << high << "):" << endl;
+
+	const int maxRids = 16;
+	RecordID rids[maxRids];
+	int numFound, count = 0;
+	for (int key = low; key <= high; key++) {
+		Status status = btf->Lookup(key, rids, maxRids, numFound);
+		if (status == FAIL) {
+			cout << "  Error: lookup failed." << endl;
+			minibase_errors.show_errors();
+			return;
+		}
+		for (int i = 0; i < numFound; i++) {
+			count++;
+			cout << "  Found @[pg,slot]=[" << rids[i].pageNo << "," << rids[i].slotNo << "]";
+			cout << " key=" << key << endl;
+		}
+	}
+	cout << "  " << count << " records found." << endl;
+	cout << "  Success." << endl;
+}
+
+
+static void printLookupResult(const int key, const RecordID rid, void* context) {
+	(*(int *)context)++;
+	cout << "  Found @[pg,slot]=[" << rid.pageNo << "," << rid.slotNo << "]";
+	cout << " key=" << key << endl;
+}
+
+
+void BTreeTest::multiLookupHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Multi looking up (" << low << " to " << high << "):" << endl;
+
+	if (high < low) {
+		cout << "  0 records found." << endl;
+		cout << "  Success." << endl;
+		return;
+	}
+
+	int numKeys = high - low + 1;
+	int* keys = new int[numKeys];
+	for (int i = 0; i < numKeys; i++) {
+		keys[i] = low + i;
+	}
+
+	int count = 0;
+	long numPins = 0;
+	Status status = btf->MultiLookup(keys, numKeys, printLookupResult, &count, numPins);
+	delete[] keys;
+	if (status != OK) {
+		cout << "  Error: multi lookup failed." << endl;
+		minibase_errors.show_errors();
+		return;
+	}
+	cout << "  " << count << " records found with " << numPins << " page pins." << endl;
+	cout << "  Success." << endl;
+}
+
+
 void BTreeTest::deleteHighLow(BTreeFile* btf, int low, int high) {
 	cout << "Deleting (" << low << "-" << high << "):" << endl;
 
@@ -219,6 +584,21 @@ void BTreeTest::deleteHighLow(BTreeFile* btf, int low, int high) {
 }
 
 
+void BTreeTest::deleteRangeHighLow(BTreeFile* btf, int low, int high) {
+	cout << "Range deleting (" << low << "-" << high << "):" << endl;
+
+	int* plow = (low == -1 ? nullptr : &low);
+	int* phigh = (high == -1 ? nullptr : &high);
+
+	if (btf->DeleteRange(plow, phigh) != OK) {
+		cout << "  Failure to delete range...\n";
+		minibase_errors.show_errors();
+		return;
+	}
+	cout << "  Success." << endl;
+}
+
+
 void BTreeTest::deleteScanHighLow(BTreeFile* btf, int low, int high) {
 	cout << "Scan/Deleting (" << low << "-" << high << "):" << endl;
 
@@ -256,3 +636,541 @@ void BTreeTest::deleteScanHighLow(BTreeFile* btf, int low, int high) {
     }
 	cout << "  Success." << endl;
 }
+
+
+void BTreeTest::searchBenchmark(int numKeys, int iterations) {
+	cout << "Search benchmark (" << numKeys << " keys, " << iterations << " searches):" << endl;
+
+	if (numKeys < 1 || iterations < 1) {
+		cout << "  Error: need at least one key and one search." << endl;
+		return;
+	}
+
+	// A full dense index page, searched through BTIndexPage::Search as
+	// in a descent, and a plain array of numKeys keys for the kernel
+	// alone.  Keys are even and probes cover the gaps and both ends.
+	Page rawPage;
+	BTIndexPage* page = (BTIndexPage *)&rawPage;
+	page->Init(0);
+	page->SetType(INDEX_NODE);
+	page->SetLeftLink(0);
+	RecordID rid;
+	for (int i = 0; i < INDEX_DENSE_CAPACITY; i++) {
+		page->Insert(2 * i, i + 1, rid);
+	}
+
+	int* keys = new int[numKeys];
+	for (int i = 0; i < numKeys; i++) {
+		keys[i] = 2 * i;
+	}
+
+	const int numProbes = 1024;
+	int pageProbes[numProbes], arrayProbes[numProbes];
+	for (int i = 0; i < numProbes; i++) {
+		pageProbes[i] = rand() % (2 * INDEX_DENSE_CAPACITY + 2) - 1;
+		arrayProbes[i] = rand() % (2 * numKeys + 2) - 1;
+	}
+
+	const KeySearchKernel* saved = SortedPage::GetSearchKernel();
+	int numKernels;
+	const KeySearchKernel* kernels = SortedPage::GetSearchKernels(numKernels);
+	long expected = 0;
+
+	for (int k = 0; k < numKernels; k++) {
+		SortedPage::SetSearchKernel(&kernels[k]);
+
+		long pageSum = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			PageID pid;
+			int outKey;
+			if (page->Search(pageProbes[i % numProbes], pid, outKey) == OK) {
+				pageSum += pid;
+			}
+		}
+		chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+
+		long arraySum = 0;
+		for (int i = 0; i < iterations; i++) {
+			arraySum += kernels[k].upperBound(keys, numKeys, arrayProbes[i % numProbes]);
+		}
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+		double pageNs = chrono::duration<double, nano>(middle - start).count() / iterations;
+		double arrayNs = chrono::duration<double, nano>(end - middle).count() / iterations;
+		cout << "  " << kernels[k].name << ": page search " << pageNs << " ns, ";
+		cout << numKeys << "-key search " << arrayNs << " ns" << endl;
+
+		if (k == 0) {
+			expected = pageSum * 31 + arraySum;
+		}
+		else if (pageSum * 31 + arraySum != expected) {
+			cout << "  Error: " << kernels[k].name << " disagrees with " << kernels[0].name << "." << endl;
+		}
+	}
+
+	SortedPage::SetSearchKernel(saved);
+	delete[] keys;
+	cout << "  Using " << saved->name << "." << endl;
+	cout << "  Success." << endl;
+}
+
+
+// Looks up numLookups of the loaded keys, the even ones below twice
+// numKeys, drawn by a generator of the thread's own, and counts those
+// found.
+static void lookupRandomKeys(BTreeFile* btf, int numKeys, int numLookups, unsigned seed, long* found) {
+	RecordID rids[4];
+	int numFound;
+	long count = 0;
+
+	for (int i = 0; i < numLookups; i++) {
+		seed = seed * 1103515245 + 12345;
+		if (btf->Lookup(2 * (int)((seed >> 8) % numKeys), rids, 4, numFound) == OK) {
+			count++;
+		}
+	}
+	*found = count;
+}
+
+
+// Scans the index again and again with a live scan until the writer
+// is done, and counts the scans that did not see each loaded key once,
+// in order.  The writer's odd keys may or may not be seen.
+static void scanLoadedKeys(BTreeFile* btf, int numKeys, const atomic<bool>* writing, long* scans, long* wrong) {
+	long count = 0, bad = 0;
+
+	do {
+		IndexFileScan* scan = btf->OpenScan(NULL, NULL);
+		RecordID rid;
+		int key, lastKey = -1, expected = 0;
+		Status status;
+
+		while ((status = scan->GetNext(rid, key)) == OK) {
+			if (key <= lastKey || (key % 2 == 0 && key != expected)) {
+				break;
+			}
+			if (key % 2 == 0) {
+				expected += 2;
+			}
+			lastKey = key;
+		}
+		delete scan;
+		count++;
+		if (status != DONE || expected != 2 * numKeys) {
+			bad++;
+		}
+	} while (writing->load());
+
+	*scans = count;
+	*wrong = bad;
+}
+
+
+void BTreeTest::threadBenchmark(int numKeys, int lookups, int maxThreads) {
+	cout << "Thread benchmark (" << numKeys << " keys, " << lookups << " lookups per thread, up to ";
+	cout << maxThreads << " threads):" << endl;
+
+	if (numKeys < 1 || lookups < 1 || maxThreads < 1) {
+		cout << "  Error: need at least one key, one lookup and one thread." << endl;
+		return;
+	}
+
+	const char* name = "ThreadBenchIndex";
+	Status status;
+	BTreeFile* btf = new BTreeFile(status, name, true);
+	if (status != OK) {
+		minibase_errors.show_errors();
+		cout << "  Error: cannot open index file." << endl;
+		delete btf;
+		return;
+	}
+
+	// Insert the even keys in random order, so that the tree looks like
+	// one built by inserts rather than a bulk load.  The first quarter
+	// goes in as one batch, into a tree emptied by a range delete, which
+	// has no root yet.
+	vector<int> order(numKeys);
+	for (int i = 0; i < numKeys; i++) {
+		order[i] = i;
+	}
+	for (int i = numKeys - 1; i > 0; i--) {
+		swap(order[i], order[rand() % (i + 1)]);
+	}
+	int numBatched = (numKeys + 3) / 4;
+	vector<LeafEntry> batch(numBatched);
+	for (int i = 0; i < numBatched; i++) {
+		batch[i].key = 2 * order[i];
+		batch[i].rid.pageNo = 2 * order[i];
+		batch[i].rid.slotNo = 2 * order[i] + 1;
+	}
+	if (btf->DeleteRange(NULL, NULL) != OK || btf->InsertBatch(batch.data(), numBatched) != OK) {
+		cout << "  Error: batch insertion failed." << endl;
+		minibase_errors.show_errors();
+		btf->DestroyFile();
+		delete btf;
+		return;
+	}
+	for (int i = numBatched; i < numKeys; i++) {
+		RecordID rid;
+		rid.pageNo = 2 * order[i];
+		rid.slotNo = 2 * order[i] + 1;
+		if (btf->Insert(2 * order[i], rid) != OK) {
+			cout << "  Error: insertion of " << 2 * order[i] << " failed." << endl;
+			minibase_errors.show_errors();
+			btf->DestroyFile();
+			delete btf;
+			return;
+		}
+	}
+
+	// Readers only.
+	double single = 0;
+	bool failed = false;
+	for (int numThreads = 1; ; numThreads *= 2) {
+		if (numThreads > maxThreads) {
+			numThreads = maxThreads;
+		}
+		vector<thread> threads;
+		vector<long> found(numThreads);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int t = 0; t < numThreads; t++) {
+			threads.push_back(thread(lookupRandomKeys, btf, numKeys, lookups, (unsigned)(t + 1), &found[t]));
+		}
+		for (int t = 0; t < numThreads; t++) {
+			threads[t].join();
+		}
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+		double rate = (double)numThreads * lookups / chrono::duration<double>(end - start).count();
+		if (numThreads == 1) {
+			single = rate;
+		}
+		cout << "  " << numThreads << " reader(s): " << (long)rate << " lookups/s, speedup ";
+		cout << rate / single << endl;
+		for (int t = 0; t < numThreads; t++) {
+			if (found[t] != lookups) {
+				failed = true;
+			}
+		}
+		if (numThreads == maxThreads) {
+			break;
+		}
+	}
+
+	// Readers and a scan alongside a writer that inserts the odd keys
+	// between the loaded ones and deletes them again, splitting and
+	// merging leaves under the scan as it goes.
+	vector<thread> threads;
+	vector<long> found(maxThreads);
+	bool writeFailed = false;
+	atomic<bool> writing(true);
+	long scans, wrongScans;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 1; t < maxThreads; t++) {
+		threads.push_back(thread(lookupRandomKeys, btf, numKeys, lookups, (unsigned)(t + 1), &found[t]));
+	}
+	thread scanner(scanLoadedKeys, btf, numKeys, &writing, &scans, &wrongScans);
+	for (int i = 0; i < numKeys; i++) {
+		RecordID rid;
+		rid.pageNo = 2 * i + 1;
+		rid.slotNo = 2 * i + 2;
+		if (btf->Insert(2 * i + 1, rid) != OK) {
+			writeFailed = true;
+		}
+	}
+	for (int i = 0; i < numKeys; i++) {
+		RecordID rid;
+		rid.pageNo = 2 * i + 1;
+		rid.slotNo = 2 * i + 2;
+		if (btf->Delete(2 * i + 1, rid) != OK) {
+			writeFailed = true;
+		}
+	}
+	writing = false;
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	scanner.join();
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+	double seconds = chrono::duration<double>(end - start).count();
+	cout << "  1 writer and " << maxThreads - 1 << " reader(s): " << (long)(2 * numKeys / seconds) << " writes/s, ";
+	cout << (long)((double)(maxThreads - 1) * lookups / seconds) << " lookups/s, " << scans << " scan(s)" << endl;
+	for (int t = 1; t < maxThreads; t++) {
+		if (found[t] != lookups) {
+			failed = true;
+		}
+	}
+	if (wrongScans != 0) {
+		failed = true;
+	}
+
+	// Every loaded key is still there, and none of the others.
+	for (int key = 0; key < 2 * numKeys; key++) {
+		RecordID rids[4];
+		int numFound;
+		if (btf->Lookup(key, rids, 4, numFound) != ((key % 2 == 0) ? OK : DONE)) {
+			failed = true;
+		}
+	}
+
+	btf->DestroyFile();
+	delete btf;
+
+	if (failed || writeFailed) {
+		cout << "  Error: lookups, scans or updates went wrong under concurrency." << endl;
+		minibase_errors.show_errors();
+		return;
+	}
+	cout << "  Success." << endl;
+}
+
+
+// Insert and delete through a live scan of a new tree of numKeys keys,
+// first in the default mode and then in thread-safe mode.
+void BTreeTest::hintScan(int numKeys) {
+	cout << "Hinted scan (" << numKeys << " keys):" << endl;
+
+	if (numKeys < 2) {
+		cout << "  Error: need at least two keys." << endl;
+		return;
+	}
+
+	const char* name = "HintIndex";
+	for (int threadSafe = 0; threadSafe < 2; threadSafe++) {
+		Status status;
+		BTreeFile* btf = new BTreeFile(status, name, threadSafe != 0);
+		if (status != OK) {
+			minibase_errors.show_errors();
+			cout << "  Error: cannot open index file." << endl;
+			delete btf;
+			return;
+		}
+		bool checked = hintScanChecked(btf, numKeys);
+		btf->DestroyFile();
+		delete btf;
+		if (!checked) {
+			return;
+		}
+		cout << "  " << 2 * numKeys << " records scanned";
+		cout << (threadSafe ? " in a thread-safe tree" : "") << " while inserting and deleting through it." << endl;
+	}
+	cout << "  Success." << endl;
+}
+
+
+// Load the even keys below 2 * numKeys and scan them.  At every even key
+// k, insert k + 1, which mostly falls in the scan's leaf, and -1 - k,
+// which mostly does not, both with the scan as hint, and delete k - 2
+// and -1 - (k - 2) the same way.  The scan has to return every key
+// from 0 up, as the odd ones are inserted just ahead of it, and only
+// the odd keys and the last even and negative ones have to be left.
+bool BTreeTest::hintScanChecked(BTreeFile* btf, int numKeys) {
+	for (int key = 0; key < 2 * numKeys; key += 2) {
+		RecordID rid;
+		rid.pageNo = key;
+		rid.slotNo = key + 1;
+		if (btf->Insert(key, rid) != OK) {
+			cout << "  Error: insertion of " << key << " failed." << endl;
+			minibase_errors.show_errors();
+			return false;
+		}
+	}
+
+	IndexFileScan* scan = btf->OpenScan(nullptr, nullptr);
+	if (scan == nullptr) {
+		cout << "  Error: cannot open a scan." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+
+	RecordID rid;
+	int ikey, expected = 0;
+	Status status;
+	while ((status = scan->GetNext(rid, ikey)) == OK) {
+		if (ikey != expected || rid.pageNo != ikey || rid.slotNo != ikey + 1) {
+			cout << "  Error: key " << ikey << " scanned where " << expected << " was expected." << endl;
+			delete scan;
+			return false;
+		}
+		expected++;
+		if (ikey % 2 != 0) {
+			continue;
+		}
+
+		RecordID newRid, oldRid;
+		newRid.pageNo = ikey + 1;
+		newRid.slotNo = ikey + 2;
+		status = btf->Insert(ikey + 1, newRid, scan);
+		if (status == OK) {
+			newRid.pageNo = newRid.slotNo = -1 - ikey;
+			status = btf->Insert(-1 - ikey, newRid, scan);
+		}
+		if ((status == OK) && (ikey >= 2)) {
+			oldRid.pageNo = ikey - 2;
+			oldRid.slotNo = ikey - 1;
+			status = btf->Delete(ikey - 2, oldRid, scan);
+			if (status == OK) {
+				oldRid.pageNo = oldRid.slotNo = 1 - ikey;
+				status = btf->Delete(1 - ikey, oldRid, scan);
+			}
+		}
+		if (status != OK) {
+			cout << "  Error: insertion or deletion at key " << ikey << " failed." << endl;
+			minibase_errors.show_errors();
+			delete scan;
+			return false;
+		}
+	}
+	delete scan;
+	if (status != DONE || expected != 2 * numKeys) {
+		cout << "  Error: the scan ended after " << expected << " keys." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+
+	int lastEven = 2 * numKeys - 2, numLeft;
+	if (!countScanned(btf, -1 - lastEven, lastEven + 1, numLeft)) {
+		return false;
+	}
+	for (int key = -1 - lastEven; key <= lastEven + 1; key++) {
+		RecordID rids[2];
+		int numFound;
+		bool kept = (key % 2 != 0 && key > 0) || key == lastEven || key == -1 - lastEven;
+		if (btf->Lookup(key, rids, 2, numFound) != (kept ? OK : DONE)) {
+			cout << "  Error: key " << key << (kept ? " is missing." : " is still there.") << endl;
+			return false;
+		}
+	}
+	if (numLeft != numKeys + 2) {
+		cout << "  Error: " << numLeft << " records left." << endl;
+		return false;
+	}
+	return true;
+}
+
+
+// Scan a new tree of numKeys keys through a snapshot while the same
+// thread inserts, deletes and splits pages under it, first in the
+// default mode and then in thread-safe mode.
+void BTreeTest::snapshotScan(int numKeys) {
+	cout << "Snapshot scan (" << numKeys << " keys):" << endl;
+
+	if (numKeys < 4) {
+		cout << "  Error: need at least four keys." << endl;
+		return;
+	}
+
+	const char* name = "SnapshotIndex";
+	for (int threadSafe = 0; threadSafe < 2; threadSafe++) {
+		Status status;
+		BTreeFile* btf = new BTreeFile(status, name, threadSafe != 0);
+		if (status != OK) {
+			minibase_errors.show_errors();
+			cout << "  Error: cannot open index file." << endl;
+			delete btf;
+			return;
+		}
+		long numKept;
+		bool scanned = snapshotScanChecked(btf, numKeys, numKept);
+		btf->DestroyFile();
+		delete btf;
+		if (!scanned) {
+			return;
+		}
+		cout << "  " << numKeys << " records scanned as of the snapshot";
+		cout << (threadSafe ? " in a thread-safe tree" : "") << ", which kept " << numKept << " pages." << endl;
+	}
+	cout << "  Success." << endl;
+}
+
+
+// Load the even keys below 2 * numKeys, open a snapshot scan and read
+// half of it, then insert every odd key, add a duplicate to every
+// loaded key, delete the lower half of the keys and some of the upper
+// half, and read the rest.  The scan has to return exactly the entries
+// loaded, and closing it has to free every page the snapshot kept and
+// leave no page it read pinned.
+bool BTreeTest::snapshotScanChecked(BTreeFile* btf, int numKeys, long& numKept) {
+	vector<LeafEntry> loaded(numKeys);
+	for (int i = 0; i < numKeys; i++) {
+		loaded[i].key = 2 * i;
+		loaded[i].rid.pageNo = i;
+		loaded[i].rid.slotNo = i + 1;
+		if (btf->Insert(loaded[i].key, loaded[i].rid) != OK) {
+			cout << "  Error: insertion of " << loaded[i].key << " failed." << endl;
+			minibase_errors.show_errors();
+			return false;
+		}
+	}
+
+	unsigned int unpinnedBefore = 0;
+	long keptBefore = Snapshots::NumPreserved();
+	IndexFileScan* scan = btf->OpenScan(nullptr, nullptr, true);
+	if (scan == nullptr) {
+		cout << "  Error: cannot open a snapshot scan." << endl;
+		minibase_errors.show_errors();
+		return false;
+	}
+
+	RecordID rid;
+	int ikey, numScanned = 0;
+	Status status = OK;
+	bool changed = false, matched = true;
+	while (matched && (status = scan->GetNext(rid, ikey)) == OK) {
+		const LeafEntry& expected = loaded[numScanned];
+		matched = (numScanned < numKeys) && (ikey == expected.key)
+			&& (rid.pageNo == expected.rid.pageNo) && (rid.slotNo == expected.rid.slotNo);
+		numScanned++;
+		if (!changed && numScanned == numKeys / 2) {
+			changed = true;
+			for (int i = 0; (status == OK) && (i < numKeys); i++) {
+				RecordID newRid;
+				newRid.pageNo = numKeys + i;
+				newRid.slotNo = i;
+				status = btf->Insert(2 * i + 1, newRid);
+				if (status == OK) {
+					status = btf->Insert(2 * i, newRid);
+				}
+			}
+			int lowKey = 0, highKey = numKeys;
+			if (status == OK) {
+				status = btf->DeleteRange(&lowKey, &highKey);
+			}
+			for (int i = numKeys / 2 + 1; (status == OK) && (i < numKeys); i += 3) {
+				status = btf->Delete(loaded[i].key, loaded[i].rid);
+			}
+			if (status != OK) {
+				cout << "  Error: changing the tree under the scan failed." << endl;
+				minibase_errors.show_errors();
+				delete scan;
+				return false;
+			}
+
+			// The new tree's first leaf stays pinned until it is freed,
+			// so pins are only counted from here on.
+			unpinnedBefore = MINIBASE_BM->GetNumOfUnpinnedFrames();
+		}
+	}
+	numKept = Snapshots::NumPreserved() - keptBefore;
+	delete scan;
+
+	if (!matched || (status != DONE) || (numScanned != numKeys)) {
+		cout << "  Error: the snapshot scan did not return the " << numKeys << " records loaded (";
+		cout << numScanned << " read)." << endl;
+		return false;
+	}
+	if (numKept == 0 || Snapshots::NumPreserved() != keptBefore) {
+		cout << "  Error: the snapshot kept " << numKept << " pages, and " << Snapshots::NumPreserved() - keptBefore;
+		cout << " are left after it closed." << endl;
+		return false;
+	}
+	if (MINIBASE_BM->GetNumOfUnpinnedFrames() != unpinnedBefore) {
+		cout << "  Error: the snapshot scan left pages pinned." << endl;
+		return false;
+	}
+	return true;
+}
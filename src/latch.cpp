@@ -0,0 +1,532 @@
+#include "minirel.h"
+#include "bufmgr.h"
+#include "db.h"
+#include "system_defs.h"
+#include "latch.h"
+#include "snapshot.h"
+#include <thread>
+
+PageLatches::Stripe PageLatches::stripes[PAGE_LATCH_STRIPES];
+
+Version PageVersions::versions[PAGE_VERSION_STRIPES];
+
+std::mutex BufferLatch::mutex;
+std::atomic<int> BufferLatch::enabled(0);
+thread_local long BufferLatch::pins = 0;
+
+std::atomic<unsigned long> Epochs::global(0);
+std::atomic<int> Epochs::numRetired(0);
+std::mutex Epochs::mutex;
+Epochs::Slot* Epochs::slots = nullptr;
+std::vector<Epochs::Retired> Epochs::retired;
+thread_local Epochs::Owner Epochs::owner;
+
+
+//-------------------------------------------------------------------
+// Latch::Acquire
+//
+// Input   : mode - shared for a reader, exclusive for a writer.
+// Output  : None
+// Purpose : Wait for the latch and take it.
+//-------------------------------------------------------------------
+
+void Latch::Acquire(LatchMode mode)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (mode == LATCH_SHARED)
+	{
+		released.wait(lock, [this] { return !writer && (waitingWriters == 0); });
+		readers++;
+	}
+	else
+	{
+		waitingWriters++;
+		released.wait(lock, [this] { return !writer && (readers == 0); });
+		waitingWriters--;
+		writer = true;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Latch::TryAcquire
+//
+// Input   : mode - shared for a reader, exclusive for a writer.
+// Output  : None
+// Purpose : Take the latch if that needs no waiting.
+// Return  : True if the latch was taken.
+//-------------------------------------------------------------------
+
+bool Latch::TryAcquire(LatchMode mode)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (writer || (waitingWriters > 0) || ((mode == LATCH_EXCLUSIVE) && (readers > 0)))
+		return false;
+
+	if (mode == LATCH_SHARED)
+		readers++;
+	else
+		writer = true;
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+// Latch::Release
+//
+// Input   : mode - the mode the latch was taken in.
+// Output  : None
+// Purpose : Give the latch up, and wake whoever waits for it.
+//-------------------------------------------------------------------
+
+void Latch::Release(LatchMode mode)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (mode == LATCH_SHARED)
+		readers--;
+	else
+		writer = false;
+	released.notify_all();
+}
+
+
+//-------------------------------------------------------------------
+// Version::Read
+//
+// Input   : None
+// Output  : None
+// Purpose : Wait for the writers in to leave, then read the version.
+// Return  : The version, to be passed to Validate after reading.
+//-------------------------------------------------------------------
+
+unsigned long Version::Read() const
+{
+	unsigned long seen = value.load(std::memory_order_acquire);
+
+	while ((seen & ((1UL << VERSION_WRITER_BITS) - 1)) != 0)
+	{
+		std::this_thread::yield();
+		seen = value.load(std::memory_order_acquire);
+	}
+	return seen;
+}
+
+
+//-------------------------------------------------------------------
+// Version::Validate
+//
+// Input   : seen - what Read returned before reading.
+// Output  : None
+// Purpose : Tell whether what was read since could have changed.
+// Return  : True if no writer came in since seen was read.
+//-------------------------------------------------------------------
+
+bool Version::Validate(unsigned long seen) const
+{
+	// What was read is ordered before the check.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return value.load(std::memory_order_relaxed) == seen;
+}
+
+
+//-------------------------------------------------------------------
+// Version::Lock, Version::Unlock, Version::Move
+//
+// A writer comes in before it changes anything and moves the version
+// on as it leaves.  Move does both at once.
+//-------------------------------------------------------------------
+
+void Version::Lock()
+{
+	value.fetch_add(1);
+}
+
+void Version::Unlock()
+{
+	value.fetch_add((1UL << VERSION_WRITER_BITS) - 1, std::memory_order_release);
+}
+
+void Version::Move()
+{
+	value.fetch_add(1UL << VERSION_WRITER_BITS, std::memory_order_release);
+}
+
+
+//-------------------------------------------------------------------
+// PageLatches::Use, PageLatches::Find, PageLatches::Unuse
+//
+// Find the latch of a page in its stripe, taken from the free ones
+// if need be, and count the threads that hold or wait for it, so that
+// it goes back after the last one.  Only a stripe with no free latch
+// makes one.  Find is for a latch already in use.
+//-------------------------------------------------------------------
+
+PageLatches::Entry* PageLatches::Use(PageID pid)
+{
+	Stripe& stripe = Of(pid);
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	Entry *entry;
+
+	for (entry = stripe.used; entry != nullptr; entry = entry->next)
+		if (entry->pid == pid)
+			break;
+
+	if (entry == nullptr)
+	{
+		if (stripe.free != nullptr)
+		{
+			entry = stripe.free;
+			stripe.free = entry->next;
+		}
+		else
+			entry = new Entry;
+		entry->pid = pid;
+		entry->users = 0;
+		entry->next = stripe.used;
+		stripe.used = entry;
+	}
+	entry->users++;
+	return entry;
+}
+
+PageLatches::Entry* PageLatches::Find(PageID pid)
+{
+	Stripe& stripe = Of(pid);
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	Entry *entry;
+
+	for (entry = stripe.used; entry->pid != pid; entry = entry->next)
+		;
+	return entry;
+}
+
+void PageLatches::Unuse(PageID pid, Entry* entry)
+{
+	Stripe& stripe = Of(pid);
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	Entry **link;
+
+	if (--entry->users > 0)
+		return;
+
+	for (link = &stripe.used; *link != entry; link = &(*link)->next)
+		;
+	*link = entry->next;
+	entry->next = stripe.free;
+	stripe.free = entry;
+}
+
+
+//-------------------------------------------------------------------
+// PageLatches::Acquire
+//
+// Input   : pid - a page.
+//           mode - shared for a reader, exclusive for a writer.
+// Output  : None
+// Purpose : Wait for the latch of the page and take it.
+//-------------------------------------------------------------------
+
+void PageLatches::Acquire(PageID pid, LatchMode mode)
+{
+	Use(pid)->latch.Acquire(mode);
+}
+
+
+//-------------------------------------------------------------------
+// PageLatches::TryAcquire
+//
+// Input   : pid - a page.
+//           mode - shared for a reader, exclusive for a writer.
+// Output  : None
+// Purpose : Take the latch of the page if that needs no waiting.
+// Return  : True if the latch was taken.
+//-------------------------------------------------------------------
+
+bool PageLatches::TryAcquire(PageID pid, LatchMode mode)
+{
+	Entry* entry = Use(pid);
+
+	if (entry->latch.TryAcquire(mode))
+		return true;
+
+	Unuse(pid, entry);
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+// PageLatches::Release
+//
+// Input   : pid - a page whose latch is held.
+//           mode - the mode it was taken in.
+// Output  : None
+// Purpose : Give the latch of the page up.
+//-------------------------------------------------------------------
+
+void PageLatches::Release(PageID pid, LatchMode mode)
+{
+	Entry* entry = Find(pid);
+
+	entry->latch.Release(mode);
+	Unuse(pid, entry);
+}
+
+
+//-------------------------------------------------------------------
+// Epochs::Enter
+//
+// Input   : None
+// Output  : None
+// Purpose : Put the calling thread in the current epoch, unless it is
+//           in one already.
+// Note    : The slot is written before the thread reads any page, so
+//           a page retired after the thread read the epoch was out of
+//           its reach, and one retired before waits for it.
+//-------------------------------------------------------------------
+
+void Epochs::Enter()
+{
+	if (owner.depth++ > 0)
+		return;
+
+	if (owner.slot == nullptr)
+		owner.slot = TakeSlot();
+	owner.slot->epoch.store(global.load());
+}
+
+
+//-------------------------------------------------------------------
+// Epochs::Exit
+//
+// Input   : None
+// Output  : None
+// Purpose : Take the calling thread out of its epoch as it leaves the
+//           outermost operation, and free the retired pages that no
+//           thread can be reading any more.
+//-------------------------------------------------------------------
+
+void Epochs::Exit()
+{
+	if ((--owner.depth > 0) || (owner.slot == nullptr))
+		return;
+
+	owner.slot->epoch.store(EPOCH_IDLE);
+	if (numRetired.load(std::memory_order_relaxed) > 0)
+		Reclaim();
+}
+
+
+//-------------------------------------------------------------------
+// Epochs::Retire
+//
+// Input   : pid - a page no longer reachable from any tree.
+// Output  : None
+// Purpose : Free the page once the threads in an epoch now have left.
+// Note    : The page is tagged with the current epoch, which then
+//           moves on, so that threads entering from now on do not
+//           hold the page back.
+//-------------------------------------------------------------------
+
+void Epochs::Retire(PageID pid)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Retired page;
+
+	page.epoch = global.fetch_add(1);
+	page.pid = pid;
+	retired.push_back(page);
+	numRetired = retired.size();
+}
+
+
+//-------------------------------------------------------------------
+// Epochs::Reclaim
+//
+// Input   : None
+// Output  : None
+// Purpose : Free the retired pages older than the oldest epoch a
+//           thread is in.
+// Note    : Called as a thread leaves its outermost epoch, and as a
+//           thread-safe tree is closed.
+//-------------------------------------------------------------------
+
+void Epochs::Reclaim()
+{
+	std::vector<PageID> freed;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		unsigned long oldest = EPOCH_IDLE;
+		size_t kept = 0;
+
+		for (Slot *slot = slots; slot != nullptr; slot = slot->next)
+			oldest = std::min(oldest, slot->epoch.load());
+
+		for (const Retired& page : retired)
+		{
+			if (page.epoch < oldest)
+				freed.push_back(page.pid);
+			else
+				retired[kept++] = page;
+		}
+		retired.resize(kept);
+		numRetired = kept;
+	}
+
+	for (PageID pid : freed)
+		if (BufferLatch::Deallocate(pid) != OK)
+			cerr << "Unable to free page " << pid << endl;
+}
+
+
+//-------------------------------------------------------------------
+// Epochs::TakeSlot, Epochs::Owner::~Owner
+//
+// A thread takes a slot nobody uses, or adds one, the first time it
+// enters an epoch, and gives it back as it ends.
+//-------------------------------------------------------------------
+
+Epochs::Slot* Epochs::TakeSlot()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Slot *slot;
+
+	for (slot = slots; slot != nullptr; slot = slot->next)
+		if (!slot->used)
+			break;
+
+	if (slot == nullptr)
+	{
+		slot = new Slot;
+		slot->epoch = EPOCH_IDLE;
+		slot->next = slots;
+		slots = slot;
+	}
+	slot->used = true;
+	return slot;
+}
+
+Epochs::Owner::~Owner()
+{
+	if (slot == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	slot->epoch = EPOCH_IDLE;
+	slot->used = false;
+}
+
+
+//-------------------------------------------------------------------
+// BufferLatch::PinPage, UnpinPage, NewPage, FreePage, CopyPage
+//
+// Call the buffer manager, under the lock once it is enabled.
+// PinPage and CopyPage count the pins of the calling thread.
+// CopyPage pins and unpins the page in one go, so that a page being
+// read is never pinned when another thread frees it.  Given a
+// snapshot, it reads the copy the snapshot kept, if any.  Called in an
+// epoch, FreePage retires the page, and Deallocate frees it when its
+// epoch has drained.  Once enabled, a page's version moves on when it
+// is unpinned dirty, freed or allocated.
+//
+// A page is preserved for open snapshots under the same lock as it is
+// pinned or freed, before the caller can change it, and CopyPage
+// looks for a kept copy under the lock as well.  So a snapshot never
+// reads a page that has started to change.  A new page needs no
+// copy: a snapshot only reads it if it was freed since.
+//
+// CopyPage takes the lock like the rest, although the version checks
+// of its callers would catch a torn copy: the buffer manager keeps its
+// frames and hash table to itself, so a page can only be found by
+// pinning it, and pinning changes the hash table and the replacer,
+// which are not safe to share.  Nor can a frame be kept and read
+// later, as the pool may hand it to another page without moving the
+// version of the first.  Uncontended, the lock adds some 5 to 20 ns to
+// a copy of about 75 ns.
+//-------------------------------------------------------------------
+
+Status BufferLatch::PinPage(PageID pid, Page*& page)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+
+	pins++;
+	if (enabled)
+		lock.lock();
+	if (MINIBASE_BM->PinPage(pid, page) != OK)
+		return FAIL;
+	if (Snapshots::Preserving())
+		Snapshots::Preserve(pid, page);
+	return OK;
+}
+
+Status BufferLatch::UnpinPage(PageID pid, bool dirty)
+{
+	if (!enabled)
+		return MINIBASE_BM->UnpinPage(pid, dirty);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (dirty)
+		PageVersions::Of(pid).Move();
+	return MINIBASE_BM->UnpinPage(pid, dirty);
+}
+
+Status BufferLatch::NewPage(PageID& pid, Page*& page)
+{
+	if (!enabled)
+		return MINIBASE_BM->NewPage(pid, page);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (MINIBASE_BM->NewPage(pid, page) != OK)
+		return FAIL;
+	PageVersions::Of(pid).Move();
+	return OK;
+}
+
+Status BufferLatch::FreePage(PageID pid)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	Page* page;
+
+	if (enabled)
+		lock.lock();
+	if (Snapshots::Preserving())
+	{
+		if (MINIBASE_BM->PinPage(pid, page) != OK)
+			return FAIL;
+		Snapshots::Preserve(pid, page);
+		if (MINIBASE_BM->UnpinPage(pid, false) != OK)
+			return FAIL;
+	}
+	if (enabled)
+		PageVersions::Of(pid).Move();
+	if (!Epochs::Retiring())
+		return MINIBASE_BM->FreePage(pid);
+
+	Epochs::Retire(pid);
+	return OK;
+}
+
+Status BufferLatch::Deallocate(PageID pid)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return MINIBASE_BM->FreePage(pid);
+}
+
+Status BufferLatch::CopyPage(PageID pid, Page& copy, Snapshot* asOf)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	Page* page;
+
+	if (enabled)
+		lock.lock();
+	if ((asOf != nullptr) && asOf->Find(pid, copy))
+		return OK;
+	pins++;
+	if (MINIBASE_BM->PinPage(pid, page) != OK)
+		return FAIL;
+	copy = *page;
+	return MINIBASE_BM->UnpinPage(pid, false);
+}
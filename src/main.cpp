@@ -33,10 +33,22 @@ int main(int argc, char *argv[]) {
 
 		cout << "Commands should be of the form:" << endl;
 		cout << "insert <low> <high>" << endl;
+		cout << "upsert <low> <high>" << endl;
+		cout << "insertifabsent <low> <high>" << endl;
+		cout << "bulkload <low> <high>" << endl;
+		cout << "insertbatch <low> <high>" << endl;
 		cout << "scan <low> <high>" << endl;
+		cout << "lookup <low> <high>" << endl;
+		cout << "multilookup <low> <high>" << endl;
 		cout << "delete <low> <high>" << endl;
+		cout << "deleterange <low> <high>" << endl;
+		cout << "searchbench <keys> <searches>" << endl;
+		cout << "threadbench <keys> <lookups> <threads>" << endl;
+		cout << "hintscan <keys>" << endl;
+		cout << "snapshotscan <keys>" << endl;
 		cout << "print" << endl;
 		cout << "stats" << endl;
+		cout << "rebalance <merge%> <redistribute%>" << endl;
 		cout << "quit" << endl;
 		cout << "Note that (<low>==-1)=>min and (<high>==-1)=>max" << endl;
 
@@ -0,0 +1,137 @@
+#include "minirel.h"
+#include "latch.h"
+#include "snapshot.h"
+#include <algorithm>
+
+thread_local Snapshots* Snapshots::writing = nullptr;
+std::atomic<long> Snapshots::numPreserved(0);
+
+
+//-------------------------------------------------------------------
+// Snapshots::~Snapshots
+//
+// Input   : None
+// Output  : None
+// Purpose : Drop the snapshots that were never closed.
+//-------------------------------------------------------------------
+
+Snapshots::~Snapshots()
+{
+	while (!open.empty())
+		Close(open.back());
+}
+
+
+//-------------------------------------------------------------------
+// Snapshots::Open
+//
+// Input   : None
+// Output  : None
+// Purpose : Start keeping the pages of the tree as they are now.
+// Return  : The new snapshot, to be closed with Close.
+//-------------------------------------------------------------------
+
+Snapshot* Snapshots::Open()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Snapshot *snapshot = new Snapshot;
+
+	snapshot->owner = this;
+	open.push_back(snapshot);
+	numOpen++;
+	return snapshot;
+}
+
+
+//-------------------------------------------------------------------
+// Snapshots::Close
+//
+// Input   : snapshot - an open snapshot of this tree.
+// Output  : None
+// Purpose : Stop keeping pages for the snapshot, and free the copies
+//           it kept.
+//-------------------------------------------------------------------
+
+void Snapshots::Close(Snapshot *snapshot)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		open.erase(std::find(open.begin(), open.end(), snapshot));
+		numOpen--;
+	}
+
+	for (auto& preImage : snapshot->preImages)
+		delete preImage.second;
+	numPreserved -= snapshot->preImages.size();
+	delete snapshot;
+}
+
+
+//-------------------------------------------------------------------
+// Snapshots::Preserve
+//
+// Input   : pid - a page the calling thread has pinned.
+//           page - the page.
+// Output  : None
+// Purpose : Copy the page into the open snapshots of the tree the
+//           thread writes to, unless they have it already.
+// Note    : Called by the buffer latch before the page can change.  A
+//           snapshot that has a copy has the one from before the first
+//           change since it was opened.
+//-------------------------------------------------------------------
+
+void Snapshots::Preserve(PageID pid, const Page *page)
+{
+	Snapshots *snapshots = writing;
+	std::lock_guard<std::mutex> lock(snapshots->mutex);
+
+	for (Snapshot *snapshot : snapshots->open)
+	{
+		Page*& preImage = snapshot->preImages[pid];
+
+		if (preImage == nullptr)
+		{
+			preImage = new Page(*page);
+			numPreserved++;
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Snapshot::Read
+//
+// Input   : pid - a page of the tree as of the snapshot.
+// Output  : copy - the page as it was when the snapshot was opened.
+// Return  : OK if successful, FAIL otherwise.
+// Purpose : Read a page of the snapshot.  Takes no latch of the tree,
+//           so writers go on meanwhile.
+//-------------------------------------------------------------------
+
+Status Snapshot::Read(PageID pid, Page& copy)
+{
+	return BufferLatch::CopyPage(pid, copy, this);
+}
+
+
+//-------------------------------------------------------------------
+// Snapshot::Find
+//
+// Input   : pid - a page.
+// Output  : copy - the kept copy of the page, if there is one.
+// Return  : True if the snapshot kept a copy of the page.
+// Note    : Called under the buffer latch, so that a page without a
+//           copy cannot start to change before it is read.
+//-------------------------------------------------------------------
+
+bool Snapshot::Find(PageID pid, Page& copy)
+{
+	std::lock_guard<std::mutex> lock(owner->mutex);
+	auto preImage = preImages.find(pid);
+
+	if (preImage == preImages.end())
+		return false;
+
+	copy = *preImage->second;
+	return true;
+}
@@ -3,9 +3,15 @@
 *
 */
 
+#include <memory.h>
+#include <atomic>
+
 #include "sortedpage.h"
-#include "btindex.h"
-#include "btleaf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86
+#endif
 
 //-------------------------------------------------------------------
 // SortedPage::InsertRecord
@@ -97,3 +103,389 @@ Status SortedPage::DeleteRecord(const RecordID& rid)
 
 	return OK;
 }
+
+
+//-------------------------------------------------------------------
+// SortedPage::GetKey
+//
+// Input   : slotNo - the position of a record on this page.
+// Output  : None
+// Purpose : Read the key of a record of a dense or slotted node.
+//           Every slotted record starts with its int key.
+// Return  : The key of the record.
+//-------------------------------------------------------------------
+
+int SortedPage::GetKey(int slotNo)
+{
+	if (GetFormat() == DENSE_FORMAT)
+		return DenseKeys()[slotNo];
+
+	return *(int *)(data + slots[slotNo].offset);
+}
+
+
+//-------------------------------------------------------------------
+// SortedPage::LowerBound
+//
+// Input   : key - the key to search for.
+// Output  : None
+// Purpose : Binary search the records, which are kept in key order.
+// Return  : The slot number of the first record whose key is not less
+//           than key, or the number of records if there is none.
+// Note    : A dense node is searched in its key array with the
+//           current search kernel, so only the keys are read.
+//-------------------------------------------------------------------
+
+int SortedPage::LowerBound(const int key)
+{
+	if (GetFormat() == DENSE_FORMAT)
+		return GetSearchKernel()->lowerBound(DenseKeys(), numOfSlots, key);
+
+	int low = 0;
+	int high = numOfSlots;
+
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (*(int *)(data + slots[mid].offset) < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+
+//-------------------------------------------------------------------
+// SortedPage::UpperBound
+//
+// Input   : key - the key to search for.
+// Output  : None
+// Purpose : Binary search the records, which are kept in key order.
+// Return  : The slot number of the first record whose key is greater
+//           than key, or the number of records if there is none.
+//-------------------------------------------------------------------
+
+int SortedPage::UpperBound(const int key)
+{
+	if (GetFormat() == DENSE_FORMAT)
+		return GetSearchKernel()->upperBound(DenseKeys(), numOfSlots, key);
+
+	int low = 0;
+	int high = numOfSlots;
+
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (*(int *)(data + slots[mid].offset) <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+
+//-------------------------------------------------------------------
+// SortedPage::MoveUpperTo
+//
+// Input   : dst - an empty node of the same type as this one.
+//           keep - the number of records this node keeps, at least
+//                  one and fewer than it holds.
+//           capacity - the records a dense node of the type holds.
+//           valueSize - the size of the value stored with each key.
+// Output  : None
+// Purpose : Move the records above the first keep of this node to
+//           dst, as is done when a node is split.  The keys and the
+//           record or page ids are each moved in one block copy.
+// Return  : The first key moved, i.e. the lowest key of dst.
+// Note    : This node has to be dense already; the node classes
+//           convert it first.
+//-------------------------------------------------------------------
+
+int SortedPage::MoveUpperTo(SortedPage& dst, int keep, int capacity, int valueSize)
+{
+	int moved = numOfSlots - keep;
+	char *values = (char *)(DenseKeys() + capacity);
+	char *dstValues = (char *)(dst.DenseKeys() + capacity);
+
+	memcpy(dst.DenseKeys(), DenseKeys() + keep, moved * sizeof(int));
+	memcpy(dstValues, values + keep * valueSize, moved * valueSize);
+	dst.numOfSlots = moved;
+	numOfSlots = keep;
+
+	return dst.DenseKeys()[0];
+}
+
+
+//-------------------------------------------------------------------
+// Key search kernels
+//
+// Since the keys are sorted, the position of key equals the number of
+// keys on the wrong side of it, so the vector kernels just compare
+// every key at once and count the matching lanes.  A node holds only
+// a handful of keys, which is less than one AVX2 register.
+//
+// The tree is built without optimization, so the kernels ask for it
+// themselves; otherwise every intrinsic goes through memory and the
+// vector code is slower than the scalar loop.
+//-------------------------------------------------------------------
+
+__attribute__((optimize("O2")))
+static int LinearLowerBound(const int *keys, int numKeys, int key)
+{
+	int i = 0;
+	while (i < numKeys && keys[i] < key)
+		i++;
+	return i;
+}
+
+__attribute__((optimize("O2")))
+static int LinearUpperBound(const int *keys, int numKeys, int key)
+{
+	int i = 0;
+	while (i < numKeys && keys[i] <= key)
+		i++;
+	return i;
+}
+
+__attribute__((optimize("O2")))
+static int BinaryLowerBound(const int *keys, int numKeys, int key)
+{
+	int low = 0;
+	int high = numKeys;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (keys[mid] < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+__attribute__((optimize("O2")))
+static int BinaryUpperBound(const int *keys, int numKeys, int key)
+{
+	int low = 0;
+	int high = numKeys;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (keys[mid] <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+#ifdef KEY_SEARCH_X86
+
+// The vector kernels keep one counter per lane: a matching lane
+// compares to -1, which is subtracted.  The lanes are summed once at
+// the end, instead of a popcount per block.
+__attribute__((target("sse2"), optimize("O2")))
+static inline int SSE2Sum(__m128i counts)
+{
+	counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(1, 0, 3, 2)));
+	counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(counts);
+}
+
+// SSE2 compares four keys per instruction.  The tail is done in scalar
+// code, as SSE2 has no masked load and the keys may end the page.
+__attribute__((target("sse2"), optimize("O2")))
+static int SSE2LowerBound(const int *keys, int numKeys, int key)
+{
+	__m128i probe = _mm_set1_epi32(key);
+	__m128i counts = _mm_setzero_si128();
+	int i = 0;
+
+	for (; i + 4 <= numKeys; i += 4)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(keys + i));
+		counts = _mm_sub_epi32(counts, _mm_cmpgt_epi32(probe, block));
+	}
+
+	int count = SSE2Sum(counts);
+	for (; i < numKeys; i++)
+		count += keys[i] < key;
+
+	return count;
+}
+
+__attribute__((target("sse2"), optimize("O2")))
+static int SSE2UpperBound(const int *keys, int numKeys, int key)
+{
+	__m128i probe = _mm_set1_epi32(key);
+	__m128i counts = _mm_setzero_si128();
+	int i = 0;
+
+	for (; i + 4 <= numKeys; i += 4)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(keys + i));
+		counts = _mm_sub_epi32(counts, _mm_cmpgt_epi32(block, probe));
+	}
+
+	int count = numKeys - SSE2Sum(counts);
+	for (; i < numKeys; i++)
+		count -= keys[i] > key;
+
+	return count;
+}
+
+__attribute__((target("avx2"), optimize("O2")))
+static inline int AVX2Sum(__m256i counts)
+{
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(counts),
+		_mm256_extracti128_si256(counts, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(half);
+}
+
+// AVX2 compares eight keys per instruction.  The last block is read
+// with a masked load, so a whole node is searched without a scalar
+// tail; the lanes past numKeys are cleared from the comparison.
+__attribute__((target("avx2"), optimize("O2")))
+static inline __m256i AVX2TailMask(int remaining)
+{
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2"), optimize("O2")))
+static int AVX2LowerBound(const int *keys, int numKeys, int key)
+{
+	__m256i probe = _mm256_set1_epi32(key);
+	__m256i counts = _mm256_setzero_si256();
+	int i = 0;
+
+	for (; i + 8 <= numKeys; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+		counts = _mm256_sub_epi32(counts, _mm256_cmpgt_epi32(probe, block));
+	}
+	if (i < numKeys)
+	{
+		__m256i mask = AVX2TailMask(numKeys - i);
+		__m256i block = _mm256_maskload_epi32(keys + i, mask);
+		__m256i less = _mm256_and_si256(_mm256_cmpgt_epi32(probe, block), mask);
+		counts = _mm256_sub_epi32(counts, less);
+	}
+
+	return AVX2Sum(counts);
+}
+
+__attribute__((target("avx2"), optimize("O2")))
+static int AVX2UpperBound(const int *keys, int numKeys, int key)
+{
+	__m256i probe = _mm256_set1_epi32(key);
+	__m256i counts = _mm256_setzero_si256();
+	int i = 0;
+
+	for (; i + 8 <= numKeys; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+		counts = _mm256_sub_epi32(counts, _mm256_cmpgt_epi32(block, probe));
+	}
+	if (i < numKeys)
+	{
+		__m256i mask = AVX2TailMask(numKeys - i);
+		__m256i block = _mm256_maskload_epi32(keys + i, mask);
+		__m256i greater = _mm256_and_si256(_mm256_cmpgt_epi32(block, probe), mask);
+		counts = _mm256_sub_epi32(counts, greater);
+	}
+
+	return numKeys - AVX2Sum(counts);
+}
+
+#endif
+
+static const KeySearchKernel searchKernels[] = {
+	{ "linear", LinearLowerBound, LinearUpperBound },
+	{ "binary", BinaryLowerBound, BinaryUpperBound },
+#ifdef KEY_SEARCH_X86
+	{ "sse2", SSE2LowerBound, SSE2UpperBound },
+	{ "avx2", AVX2LowerBound, AVX2UpperBound },
+#endif
+};
+
+// Read by every thread that searches a page, and chosen by the first.
+static std::atomic<const KeySearchKernel*> searchKernel(NULL);
+
+
+//-------------------------------------------------------------------
+// SortedPage::GetSearchKernels
+//
+// Input   : None
+// Output  : numKernels - the number of kernels returned.
+// Purpose : List the search kernels that the running CPU supports.
+// Return  : The kernels, ordered from the slowest to the fastest.
+//-------------------------------------------------------------------
+
+const KeySearchKernel* SortedPage::GetSearchKernels(int& numKernels)
+{
+	numKernels = 2;
+
+#ifdef KEY_SEARCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		numKernels++;
+		if (__builtin_cpu_supports("avx2"))
+			numKernels++;
+	}
+#endif
+
+	return searchKernels;
+}
+
+
+//-------------------------------------------------------------------
+// SortedPage::GetSearchKernel
+//
+// Input   : None
+// Output  : None
+// Purpose : Get the kernel used to search dense nodes, choosing the
+//           fastest supported one the first time.
+// Return  : The current search kernel.
+// Note    : Threads that choose at once all choose the same kernel,
+//           and one forced meanwhile is kept.
+//-------------------------------------------------------------------
+
+const KeySearchKernel* SortedPage::GetSearchKernel()
+{
+	const KeySearchKernel *kernel = searchKernel.load(std::memory_order_acquire);
+
+	if (kernel == NULL)
+	{
+		int numKernels;
+		const KeySearchKernel *kernels = GetSearchKernels(numKernels);
+		const KeySearchKernel *best = &kernels[numKernels - 1];
+
+		if (searchKernel.compare_exchange_strong(kernel, best, std::memory_order_acq_rel))
+			kernel = best;
+	}
+
+	return kernel;
+}
+
+
+//-------------------------------------------------------------------
+// SortedPage::SetSearchKernel
+//
+// Input   : kernel - one of the kernels from GetSearchKernels.
+// Output  : None
+// Purpose : Force the kernel used to search dense nodes.
+// Return  : None
+//-------------------------------------------------------------------
+
+void SortedPage::SetSearchKernel(const KeySearchKernel* kernel)
+{
+	searchKernel.store(kernel, std::memory_order_release);
+}